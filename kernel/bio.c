@@ -102,6 +102,20 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block, filled with
+// zeros rather than read from disk, for a block whose old
+// contents do not matter.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,6 +125,66 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Return the cached copy of the indicated block, locked,
+// or 0 if there is none, without taking a buffer for it.
+static struct buf*
+bcached(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      if(b->valid)
+        return b;
+      brelse(b);
+      return 0;
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Direct I/O: move a block between the disk and physical
+// address pa without going through the cache. A cached copy
+// of the block may be newer than the disk, since it may hold
+// changes not yet committed, so a read takes the cached copy
+// if there is one. A write to a cached block goes through the
+// log instead of to the disk: the block may have changed hands
+// in the open transaction, as when writeidirect() has just
+// allocated and zeroed it, and must not reach its home
+// location before that commits. Caller of bwritedirect() must
+// be in a transaction.
+void
+breaddirect(uint dev, uint blockno, uint64 pa)
+{
+  struct buf *b;
+
+  if((b = bcached(dev, blockno)) != 0){
+    memmove((void*)pa, b->data, BSIZE);
+    brelse(b);
+    return;
+  }
+  virtio_disk_rwdirect(blockno, pa, 0);
+}
+
+void
+bwritedirect(uint dev, uint blockno, uint64 pa)
+{
+  struct buf *b;
+
+  if((b = bcached(dev, blockno)) != 0){
+    memmove(b->data, (void*)pa, BSIZE);
+    log_write(b);
+    brelse(b);
+    return;
+  }
+  virtio_disk_rwdirect(blockno, pa, 1);
+}
+
 // Release a locked buffer.
 // Move to the head of the most-recently-used list.
 void
@@ -1,19 +1,27 @@
 struct buf;
 struct context;
+struct dirinfo;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
+struct cpustats;
+struct schedinfo;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct istats;
 struct superblock;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            breaddirect(uint, uint, uint64);
+void            bwritedirect(uint, uint, uint64);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -33,32 +41,57 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filepread(struct file*, uint64, int, uint);
+int             filepwrite(struct file*, uint64, int, uint);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filegetdents(struct file*, uint64, int);
+int             filesend(struct file*, struct file*, uint*, int);
+int             filesync(struct file*, int);
+int             filefallocate(struct file*, int, uint, uint);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+void            dirunlink(struct inode*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+int             dirread(struct inode*, uint*, struct dirinfo*, int);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
+void            istat(struct istats*);
+void            iflush(struct inode*, uint);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            ireap(void);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
+struct inode*   nameiat(struct inode*, char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             readidirect(struct inode*, uint64, uint, uint);
+int             writeidirect(struct inode*, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             ifalloc(struct inode*, uint, uint);
+int             ipunch(struct inode*, uint, uint);
 
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// ipi.c
+void            ipiinit(void);
+void            ipiwake(int);
+void            ipiresched(int);
+void            tlbshootdown(void);
+int             ipiintr(void);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
@@ -69,12 +102,15 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+uint            log_seq(void);
+void            log_force(uint);
+int             log_async(int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -86,7 +122,6 @@ int             cpuid(void);
 void            exit(int);
 int             fork(void);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -103,9 +138,16 @@ void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+void            schedtick(void);
+void            resched(void);
+int             cpustat(struct cpustats*, int);
+int             setpriority(int, int);
+int             setsched(int, int, int);
+int             getsched(int, struct schedinfo*);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             kthread_create(void (*)(void*), void*, char*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -124,6 +166,9 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// start.c
+int             timerfired(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -142,12 +187,20 @@ int             fetchaddr(uint64, uint64*);
 void            syscall();
 
 // trap.c
-extern uint     ticks;
-void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// timer.c
+void            timerqinit(void);
+uint            ticknow(void);
+void            timerstart(void);
+void            timeridle(void);
+int             timerintr(void);
+int             timersleep(uint64);
+int             ticksleep(int);
+int             nanosleep(uint64);
+uint64          nanouptime(void);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -159,6 +212,8 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+int             kvmstack(uint64);
+void*           kvmunstack(uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
@@ -170,6 +225,7 @@ void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
+uint64          useraddr(pagetable_t, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -183,6 +239,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwdirect(uint, uint64, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -31,12 +31,8 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
-  begin_op();
-
-  if((ip = namei(path)) == 0){
-    end_op();
+  if((ip = namei(path)) == 0)
     return -1;
-  }
   ilock(ip);
 
   // Check ELF header
@@ -70,7 +66,6 @@ exec(char *path, char **argv)
       goto bad;
   }
   iunlockput(ip);
-  end_op();
   ip = 0;
 
   p = myproc();
@@ -135,10 +130,8 @@ exec(char *path, char **argv)
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
-  if(ip){
+  if(ip)
     iunlockput(ip);
-    end_op();
-  }
 
   return -1;
 }
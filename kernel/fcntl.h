@@ -3,3 +3,9 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_DIRECT  0x800  // whole blocks skip the buffer cache
+
+#define FALLOC_KEEP_SIZE  0x1  // fallocate(): leave the file size alone
+#define FALLOC_PUNCH_HOLE 0x2  // fallocate(): free the range instead
+
+#define AT_FDCWD  -100   // fstatat(): path is relative to the current directory
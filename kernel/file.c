@@ -11,7 +11,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "fcntl.h"
 #include "proc.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -76,9 +78,16 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
-    iput(ff.ip);
-    end_op();
+    if(ff.type == FD_INODE && ff.writable){
+      // a writer is likely the one that unlinked the file;
+      // free it now rather than in some later transaction.
+      iflush(ff.ip, 0);
+      begin_op();
+      iput(ff.ip);
+      end_op();
+    } else {
+      iput(ff.ip);
+    }
   }
 }
 
@@ -101,10 +110,73 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Wait until file f is on disk: its waiting blocks allocated
+// and the transaction group holding its last change committed.
+// If datasync, a change that only touched the inode's link
+// count need not be waited for. Groups that did not touch f are
+// left alone, unless they came before f's.
 int
-fileread(struct file *f, uint64 addr, int n)
+filesync(struct file *f, int datasync)
+{
+  struct inode *ip;
+  uint seq;
+
+  if(f->type == FD_DEVICE)
+    return 0;
+  if(f->type != FD_INODE)
+    return -1;
+  ip = f->ip;
+  iflush(ip, 0);
+  ilock(ip);
+  seq = datasync ? ip->dseq : ip->lseq;
+  iunlock(ip);
+  log_force(seq);
+  return 0;
+}
+
+// Set disk blocks aside for bytes off..off+len-1 of f, which
+// then read as zeros until written, and grow f to cover them
+// unless mode has FALLOC_KEEP_SIZE. With FALLOC_PUNCH_HOLE,
+// free the blocks instead, leaving the size alone. Works a
+// transaction's worth at a time, like filewrite().
+int
+filefallocate(struct file *f, int mode, uint off, uint len)
+{
+  struct inode *ip;
+  int r;
+
+  if(f->type != FD_INODE || f->writable == 0)
+    return -1;
+  if(off + len < off || (uint64)off + len > (uint64)MAXFILE*BSIZE)
+    return -1;
+  ip = f->ip;
+  // waiting blocks would only be in the way.
+  iflush(ip, 0);
+  while(len > 0){
+    begin_op();
+    ilock(ip);
+    if(mode & FALLOC_PUNCH_HOLE){
+      r = ipunch(ip, off, len);
+    } else if((r = ifalloc(ip, off, len)) == len &&
+              (mode & FALLOC_KEEP_SIZE) == 0 && off + len > ip->size){
+      ip->size = off + len;
+      iupdate(ip);
+    }
+    iunlock(ip);
+    end_op();
+    if(r < 0)
+      return -1;
+    off += r;
+    len -= r;
+  }
+  return 0;
+}
+
+// Read from file f into dst.
+// If user_dst==1, then dst is a user virtual address;
+// otherwise, dst is a kernel address.
+static int
+fileread1(struct file *f, int user_dst, uint64 dst, int n)
 {
   int r = 0;
 
@@ -112,14 +184,18 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, dst, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, dst, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if(f->direct && user_dst)
+      r = readidirect(f->ip, dst, f->off, n);
+    else
+      r = readi(f->ip, user_dst, dst, f->off, n);
+    if(r > 0)
       f->off += r;
     iunlock(f->ip);
   } else {
@@ -129,50 +205,164 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
+{
+  return fileread1(f, 1, addr, n);
+}
+
+// Read from inode file f at offset off, leaving f->off alone.
+// addr is a user virtual address.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(f->direct)
+    r = readidirect(f->ip, addr, off, n);
+  else
+    r = readi(f->ip, 1, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Read from file f into the n user buffers of iov in turn,
+// stopping at the end of the file. An inode stays locked
+// throughout, so the read is not mixed with others' writes.
+// With O_DIRECT, aligned blocks bypass the cache, as in read().
+int
+filereadv(struct file *f, struct iovec *iov, int n)
+{
+  int i, r, tot;
+
+  if(f->readable == 0)
+    return -1;
+
+  tot = 0;
+  if(f->type != FD_INODE){
+    for(i = 0; i < n; i++){
+      if((r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+        return -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
+
+  ilock(f->ip);
+  for(i = 0; i < n; i++){
+    if(f->direct)
+      r = readidirect(f->ip, (uint64)iov[i].iov_base, f->off, iov[i].iov_len);
+    else
+      r = readi(f->ip, 1, (uint64)iov[i].iov_base, f->off, iov[i].iov_len);
+    if(r < 0){
+      tot = -1;
+      break;
+    }
+    f->off += r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  return tot;
+}
+
+// Read up to n entries of directory f into the struct dirinfo
+// array at user address addr, NDIRREAD at a time.
+// Returns the number read, 0 at the end of the directory.
+int
+filegetdents(struct file *f, uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct dirinfo di[NDIRREAD];
+  int r, tot;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+
+  for(tot = 0; tot < n; tot += r){
+    r = dirread(f->ip, &f->off, di, n - tot);
+    if(r < 0)
+      return -1;
+    if(r > 0 && copyout(p->pagetable, addr + tot*sizeof(di[0]), (char*)di, r*sizeof(di[0])) < 0)
+      return -1;
+    if(r < NDIRREAD)
+      return tot + r;
+  }
+  return tot;
+}
+
+// write a few blocks at a time to avoid exceeding
+// the maximum log transaction size, including
+// i-node, indirect block, allocation blocks,
+// and 2 blocks of slop for non-aligned writes.
+// this really belongs lower down, since writei()
+// might be writing a device like the console.
+#define MAXWRITE (((MAXOPBLOCKS-1-1-2) / 2) * BSIZE)
+
+// Write n bytes from src to inode file f at offset *off,
+// MAXWRITE at a time, advancing *off. If user_src==1, then
+// src is a user virtual address; otherwise, a kernel address.
+static int
+inodewrite(struct file *f, int user_src, uint64 src, int n, uint *off)
 {
-  int r, ret = 0;
+  int r, i;
+
+  i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > MAXWRITE)
+      n1 = MAXWRITE;
+
+    // leave room for this write's new blocks to wait for
+    // allocation (see "Delayed allocation" in fs.c).
+    iflush(f->ip, NDELAY/2 - (n1/BSIZE + 2));
+    begin_op();
+    ilock(f->ip);
+    if(f->direct && user_src)
+      r = writeidirect(f->ip, src + i, *off, n1);
+    else
+      r = writei(f->ip, user_src, src + i, *off, n1);
+    if(r > 0)
+      *off += r;
+    iunlock(f->ip);
+    end_op();
+
+    if(r != n1){
+      // error from writei
+      break;
+    }
+    i += r;
+  }
+  return (i == n ? n : -1);
+}
+
+// Write to file f from src.
+// If user_src==1, then src is a user virtual address;
+// otherwise, src is a kernel address.
+static int
+filewrite1(struct file *f, int user_src, uint64 src, int n)
+{
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, src, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, src, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    ret = inodewrite(f, user_src, src, n, &f->off);
   } else {
     panic("filewrite");
   }
@@ -180,3 +370,114 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return filewrite1(f, 1, addr, n);
+}
+
+// Write to inode file f at offset off, leaving f->off alone.
+// addr is a user virtual address.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return inodewrite(f, 1, addr, n, &off);
+}
+
+// Write the n user buffers of iov to file f in turn. If they
+// add up to no more than MAXWRITE, an inode file gets them
+// all in one transaction, so the write is atomic. With
+// O_DIRECT, aligned blocks bypass the cache, as in write().
+int
+filewritev(struct file *f, struct iovec *iov, int n)
+{
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+
+  tot = 0;
+  for(i = 0; i < n; i++)
+    tot += iov[i].iov_len;
+  if(f->type != FD_INODE || tot > MAXWRITE){
+    for(i = 0; i < n; i++)
+      if(filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len) < 0)
+        return -1;
+    return tot;
+  }
+
+  iflush(f->ip, NDELAY/2 - (tot/BSIZE + 2));
+  begin_op();
+  ilock(f->ip);
+  for(i = 0; i < n; i++){
+    if(f->direct)
+      r = writeidirect(f->ip, (uint64)iov[i].iov_base, f->off, iov[i].iov_len);
+    else
+      r = writei(f->ip, 1, (uint64)iov[i].iov_base, f->off, iov[i].iov_len);
+    if(r > 0)
+      f->off += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  end_op();
+  return i == n ? tot : -1;
+}
+
+// Move up to n bytes from file in to file out inside the kernel,
+// a page at a time, so that they never pass through user memory
+// and a whole page goes to a pipe in one pipewrite(). Inode file
+// in is read at *off, which is advanced, if off is not 0, and
+// otherwise at its own offset. Stops early at the end of in, or
+// after a short read from a pipe or device.
+// Returns the number of bytes written to out.
+int
+filesend(struct file *out, struct file *in, uint *off, int n)
+{
+  char *buf;
+  int r, w, m, tot;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if(off && in->type != FD_INODE)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  tot = 0;
+  while(tot < n){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if(off){
+      ilock(in->ip);
+      if((r = readi(in->ip, 0, (uint64)buf, *off, m)) > 0)
+        *off += r;
+      iunlock(in->ip);
+    } else {
+      r = fileread1(in, 0, (uint64)buf, m);
+    }
+    if(r <= 0){
+      if(r < 0 && tot == 0)
+        tot = -1;
+      break;
+    }
+    w = filewrite1(out, 0, (uint64)buf, r);
+    if(w != r){
+      if(w > 0)
+        tot += w;
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    tot += w;
+    if(r < m)
+      break;
+  }
+  kfree(buf);
+  return tot;
+}
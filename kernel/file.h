@@ -6,6 +6,7 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  char direct;       // FD_INODE opened with O_DIRECT
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +19,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // hash chain, or free list
+  struct inode *lprev;  // list of unreferenced inodes
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +30,18 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  uchar data[NINLINE]; // content, if flags & DI_INLINE
+  int next;           // number of extents in use
+  struct extent ext[MAXEXTENT]; // ext[NEXTENT..] live in extblock
+  uint extblock;
+  int extdirty;       // extblock needs to be written by iupdate()
+  uint ndelay;        // blocks written but not yet allocated
+  uint dfirst;        // lowest such block
+  uint dres;          // free blocks set aside for them
+  struct inode *orphan; // next on the orphan list
+  uint lseq;          // log group of its last change
+  uint dseq;          // log group of its last change to content
 };
 
 // map major device number to device functions.
@@ -26,6 +26,28 @@
 // only one device
 struct superblock sb; 
 
+#define NGROUP (FSSIZE/BPG + 1)   // max block groups
+
+// In-memory summary of free space, so that allocation does
+// not have to read every bitmap block and inode block to
+// find a free one: the number of free blocks and of free
+// inodes in each block group, a rotating hint per group for
+// where to put the next block that does not extend a file's
+// extent, and the lowest inode in each group that may be free.
+// Also the total number of free blocks, and how many of those
+// are set aside for blocks whose allocation is delayed.
+// Built by fsinit() from the disk; thereafter kept up to
+// date by balloc(), brun(), bfree(), ialloc() and iput().
+struct {
+  struct spinlock lock;
+  ushort bfree[NGROUP];
+  ushort ifree[NGROUP];
+  uint bhint[NGROUP];
+  uint ihint[NGROUP];
+  uint nfree;
+  uint reserved;
+} fsum;
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -37,13 +59,49 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+// Count the free blocks and inodes in each group.
+static void
+fsuminit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint g, b, bn, inum;
+
+  initlock(&fsum.lock, "fsum");
+  if(sb.ngroups > NGROUP)
+    panic("fsinit: file system too big");
+
+  for(g = 0; g < sb.ngroups; g++){
+    bp = bread(dev, GSTART(g, sb));
+    for(b = GSTART(g, sb); b < GSTART(g+1, sb) && b < sb.size; b++)
+      if((bp->data[BBIT(b, sb)/8] & (1 << (BBIT(b, sb)%8))) == 0)
+        fsum.bfree[g]++;
+    brelse(bp);
+    fsum.nfree += fsum.bfree[g];
+
+    for(bn = GSTART(g, sb) + 1; bn < GDATA(g, sb); bn++){
+      bp = bread(dev, bn);
+      for(dip = (struct dinode*)bp->data; dip < (struct dinode*)bp->data + IPB; dip++){
+        inum = g*sb.ipg + (bn - GSTART(g, sb) - 1)*IPB + (dip - (struct dinode*)bp->data);
+        if(inum > 0 && dip->type == 0)
+          fsum.ifree[g]++;
+      }
+      brelse(bp);
+    }
+
+    fsum.bhint[g] = GDATA(g, sb);
+    fsum.ihint[g] = g*sb.ipg;
+  }
+}
+
 // Init fs
 void
 fsinit(int dev) {
   readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
+  if(sb.magic != FSMAGIC || sb.version != FSVERSION)
     panic("invalid file system");
   initlog(dev, &sb);
+  fsuminit(dev);
 }
 
 // Zero a block.
@@ -52,56 +110,314 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  bp = bnew(dev, bno);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+#define BRUN 32  // blocks in a fresh run for a growing file
+
+// Is block b free? bp holds b's bitmap block.
+static int
+bisfree(struct buf *bp, uint b)
+{
+  int bi = BBIT(b, sb);
+  return (bp->data[bi/8] & (1 << (bi % 8))) == 0;
+}
+
+// Search the bitmap block bp of group g, from block from on,
+// a word at a time. If n is BRUN, look for a BRUN-aligned run
+// of free blocks (a zero 32-bit word); otherwise for any free
+// block (a 64-bit word with a zero bit).
+// Returns the first block found, or 0.
+static uint
+bmapscan(struct buf *bp, uint g, uint from, uint n)
+{
+  uint32 *w32;
+  uint64 *w64, w;
+  uint base, i, bit;
+
+  base = GSTART(g, sb);
+  if(n == BRUN){
+    w32 = (uint32*)bp->data;
+    for(i = (from - base + 31) / 32; i < BPG/32; i++){
+      if(base + (i+1)*32 > sb.size)
+        break;
+      if(w32[i] == 0)
+        return base + i*32;
+    }
+    return 0;
+  }
+
+  w64 = (uint64*)bp->data;
+  for(i = (from - base) / 64; i < BPG/64; i++){
+    w = w64[i];
+    if(i == (from - base) / 64)
+      w |= ((uint64)1 << ((from - base) % 64)) - 1;  // ignore blocks before from
+    if(w == ~(uint64)0)
+      continue;
+    for(bit = 0; w & ((uint64)1 << bit); bit++)
+      ;
+    if(base + i*64 + bit >= sb.size)
+      break;
+    return base + i*64 + bit;
+  }
+  return 0;
+}
+
+// Look for n (1 or BRUN) free blocks, searching from block
+// start and wrapping around, skipping groups that the summary
+// says are too full. Returns the first block, with its bitmap
+// block locked in *bpp, or 0 if there is none.
 static uint
-balloc(uint dev)
+bscan(uint dev, uint start, uint n, struct buf **bpp)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, g, k, nfree;
+
+  if(start < sb.groupstart || start >= sb.size)
+    start = sb.groupstart;
+  for(k = 0; k <= sb.ngroups; k++){
+    // the final pass looks at the part of start's group
+    // that comes before start.
+    g = (BGROUP(start, sb) + k) % sb.ngroups;
+    acquire(&fsum.lock);
+    nfree = fsum.bfree[g];
+    release(&fsum.lock);
+    if(nfree < n)
+      continue;
+    bp = bread(dev, GSTART(g, sb));
+    b = bmapscan(bp, g, k == 0 ? start : GSTART(g, sb), n);
+    if(b){
+      *bpp = bp;
+      return b;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+// Mark block b in use in its bitmap block bp, release bp,
+// and zero the block.
+static uint
+btake(uint dev, struct buf *bp, uint b)
+{
+  int bi;
+  uint g;
+
+  bi = BBIT(b, sb);
+  bp->data[bi/8] |= 1 << (bi % 8);
+  log_write(bp);
+  brelse(bp);
+
+  g = BGROUP(b, sb);
+  acquire(&fsum.lock);
+  fsum.bfree[g]--;
+  fsum.nfree--;
+  release(&fsum.lock);
+
+  bzero(dev, b);
+  return b;
+}
+
+// Find a free block, preferably goal. If goal is taken, look
+// for n free blocks from a little way past it, so that a file
+// that is still growing (n = BRUN) starts a new run with room
+// to grow into, and leaves room for whatever took goal to grow
+// too. Returns the block with its bitmap block locked in
+// *bpp, or 0.
+static uint
+bfind(uint dev, uint goal, uint n, struct buf **bpp)
+{
+  uint b;
+  struct buf *bp;
+
+  if(goal >= sb.groupstart && goal < sb.size){
+    bp = bread(dev, BBLOCK(goal, sb));
+    if(bisfree(bp, goal)){
+      *bpp = bp;
+      return goal;
     }
     brelse(bp);
   }
+
+  if(n > 1 && (b = bscan(dev, goal + 4*BRUN, n, bpp)) != 0)
+    return b;
+  return bscan(dev, goal, 1, bpp);
+}
+
+// Allocate a zeroed disk block, as bfind() chooses, leaving
+// alone the blocks set aside for delayed allocation.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal, uint n)
+{
+  uint b;
+  int avail;
+  struct buf *bp;
+
+  acquire(&fsum.lock);
+  avail = fsum.nfree > fsum.reserved;
+  release(&fsum.lock);
+  if(avail && (b = bfind(dev, goal, n, &bp)) != 0)
+    return btake(dev, bp, b);
   printf("balloc: out of blocks\n");
   return 0;
 }
 
-// Free a disk block.
-static void
-bfree(int dev, uint b)
+// How many of blocks b..b+n-1 are free, from b on? bp holds
+// b's bitmap block.
+static uint
+bfreerun(struct buf *bp, uint b, uint n)
+{
+  uint k, g;
+
+  g = BGROUP(b, sb);
+  for(k = 0; k < n && b + k < GSTART(g+1, sb) && b + k < sb.size; k++)
+    if(!bisfree(bp, b + k))
+      break;
+  return k;
+}
+
+// Allocate up to n consecutive blocks out of those set aside
+// by breserve(), without zeroing them: the caller is about to
+// overwrite them. The run starts at goal if all n blocks fit
+// there, otherwise where bfind() would start a new run. Sets
+// *got to the number allocated; returns the first, or 0.
+static uint
+brun(uint dev, uint goal, uint n, uint *got)
 {
+  uint b, i, k, g;
+  int bi;
   struct buf *bp;
-  int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
+  b = 0;
+  if(goal >= sb.groupstart && goal < sb.size){
+    bp = bread(dev, BBLOCK(goal, sb));
+    if(bfreerun(bp, goal, n) == n)
+      b = goal;
+    else
+      brelse(bp);
+  }
+  if(b == 0 && n > 1)
+    b = bscan(dev, goal + 4*BRUN, BRUN, &bp);
+  if(b == 0 && (b = bfind(dev, goal, 1, &bp)) == 0)
+    return 0;
+  g = BGROUP(b, sb);
+  k = bfreerun(bp, b, n);
+  for(i = 0; i < k; i++){
+    bi = BBIT(b + i, sb);
+    bp->data[bi/8] |= 1 << (bi % 8);
+  }
   log_write(bp);
   brelse(bp);
+
+  acquire(&fsum.lock);
+  fsum.bfree[g] -= k;
+  fsum.nfree -= k;
+  fsum.reserved -= k;
+  release(&fsum.lock);
+  *got = k;
+  return b;
+}
+
+// Set aside n free blocks for delayed allocation.
+static int
+breserve(uint n)
+{
+  int ok;
+
+  acquire(&fsum.lock);
+  ok = fsum.nfree - fsum.reserved >= n;
+  if(ok)
+    fsum.reserved += n;
+  release(&fsum.lock);
+  return ok ? 0 : -1;
+}
+
+// Return n blocks set aside by breserve().
+static void
+bunreserve(uint n)
+{
+  acquire(&fsum.lock);
+  fsum.reserved -= n;
+  release(&fsum.lock);
+}
+
+// Where to put a block for ip that does not continue one of
+// its extents, such as a file's first block: the next free
+// block after the last such block in the inode's group. New
+// files thus pack together, without landing at the end of the
+// runs that growing files are extending.
+static uint
+bhint(struct inode *ip)
+{
+  uint b;
+
+  acquire(&fsum.lock);
+  b = fsum.bhint[IGROUP(ip->inum, sb)];
+  release(&fsum.lock);
+  return b;
+}
+
+// Blocks b..b+n-1 were allocated at ip's bhint(); move the
+// hint past them.
+static void
+bhintpast(struct inode *ip, uint b, uint n)
+{
+  uint g;
+
+  g = IGROUP(ip->inum, sb);
+  if(BGROUP(b, sb) != g)
+    return;
+  acquire(&fsum.lock);
+  fsum.bhint[g] = b + n < GSTART(g+1, sb) ? b + n : GDATA(g, sb);
+  release(&fsum.lock);
+}
+
+// Allocate a block for ip at bhint().
+static uint
+bfirst(struct inode *ip)
+{
+  uint b;
+
+  if((b = balloc(ip->dev, bhint(ip), 1)) != 0)
+    bhintpast(ip, b, 1);
+  return b;
+}
+
+// Free n disk blocks starting at b.
+static void
+bfree(int dev, uint b, uint n)
+{
+  struct buf *bp;
+  int bi, m;
+
+  bp = 0;
+  for(; n > 0; b++, n--){
+    if(bp == 0 || bp->blockno != BBLOCK(b, sb)){
+      if(bp){
+        log_write(bp);
+        brelse(bp);
+      }
+      bp = bread(dev, BBLOCK(b, sb));
+    }
+    bi = BBIT(b, sb);
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0)
+      panic("freeing free block");
+    bp->data[bi/8] &= ~m;
+    acquire(&fsum.lock);
+    fsum.bfree[BGROUP(b, sb)]++;
+    fsum.nfree++;
+    release(&fsum.lock);
+  }
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
 }
 
 // Inodes.
@@ -111,9 +427,9 @@ bfree(int dev, uint b)
 // its size, the number of links referring to it, and the
 // list of blocks holding the file's content.
 //
-// The inodes are laid out sequentially on disk at block
-// sb.inodestart. Each inode has a number, indicating its
-// position on the disk.
+// The inodes are laid out sequentially on disk, sb.ipg of
+// them after the free map block of each block group. Each
+// inode has a number, indicating its position on the disk.
 //
 // The kernel keeps a table of in-use inodes in memory
 // to provide a place for synchronizing access
@@ -129,18 +445,20 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref. An entry
+//   whose ref has fallen to zero stays in the table, so that
+//   the next iget() of the inode need not read it from disk
+//   again, until it is the least recently used and its
+//   memory is needed for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,60 +482,283 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is a hash table on (dev, inum). Entries are
+// carved out of pages from kalloc() as needed, so there is no
+// fixed limit on the number of inodes in use; once there are
+// NINODE entries, unreferenced ones are reused before more
+// pages are taken.
+//
+// Each hash bucket's spin-lock protects the ip->ref, ip->dev,
+// ip->inum and ip->hnext of the entries in that bucket; one
+// must hold it while using any of those fields. itable.lock
+// protects the list of unreferenced entries, the free list,
+// and the counts, and is acquired after a bucket lock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 31
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;
+  uint64 gets;     // iget() calls for inodes in this bucket
+  uint64 hits;     // ... that found the inode in the table
+};
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct ibucket bucket[NIHASH];
+
+  // Unreferenced entries that are still hashed, through
+  // lprev/lnext. lruhead is the most recently used.
+  struct inode *lruhead;
+  struct inode *lrutail;
+  uint nlru;
+
+  struct inode *free;  // unhashed entries, through hnext
+  uint nfree;
+  uint ninode;         // entries allocated
+  uint64 evictions;
 } itable;
 
+// Inodes whose last reference was dropped outside a transaction
+// while they had no links. Freeing an inode writes to the disk,
+// so iput() hands such an inode, still referenced, to this list,
+// and the next end_op() frees it in a transaction of its own.
+// This lets lookups that only read, such as open() of an
+// existing file, chdir() and exec(), stay out of the log.
+struct {
+  struct spinlock lock;
+  struct inode *head;  // through ip->orphan
+  int reaping;         // some ireap() is freeing them
+} orphans;
+
+static void dcinit(void);
+static void dcput(struct inode *dp, char *name, uint inum);
+static void dcpurge(struct inode *dp);
+static void dinit(void);
+static void ddrop(struct inode *ip);
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  initlock(&orphans.lock, "orphans");
+  for(i = 0; i < NIHASH; i++) {
+    initlock(&itable.bucket[i].lock, "itable.bucket");
+  }
+  dcinit();
+  dinit();
+}
+
+static struct ibucket*
+ibucket(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 7 + inum) % NIHASH];
+}
+
+// Add ip, whose ref has fallen to zero, to the front of the
+// unreferenced list. Caller must hold itable.lock.
+static void
+lruadd(struct inode *ip)
+{
+  ip->lprev = 0;
+  ip->lnext = itable.lruhead;
+  if(itable.lruhead)
+    itable.lruhead->lprev = ip;
+  else
+    itable.lrutail = ip;
+  itable.lruhead = ip;
+  itable.nlru++;
+}
+
+// Caller must hold itable.lock.
+static void
+lruremove(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    itable.lruhead = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    itable.lrutail = ip->lprev;
+  itable.nlru--;
+}
+
+// Put ip, unhashed, on the free list.
+static void
+ifree(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->hnext = itable.free;
+  itable.free = ip;
+  itable.nfree++;
+  release(&itable.lock);
+}
+
+// Add a page's worth of entries to the free list.
+static void
+igrow(void)
+{
+  char *pa;
+  struct inode *ip;
+
+  if((pa = kalloc()) == 0)
+    panic("iget: no inodes");
+  memset(pa, 0, PGSIZE);
+  for(ip = (struct inode*)pa; ip + 1 <= (struct inode*)(pa + PGSIZE); ip++){
+    initsleeplock(&ip->lock, "inode");
+    acquire(&itable.lock);
+    itable.ninode++;
+    release(&itable.lock);
+    ifree(ip);
+  }
+}
+
+// Return an unhashed table entry: a free one if there is one;
+// else, once the table has NINODE entries, the least recently
+// used unreferenced one; else a new one.
+static struct inode*
+inew(void)
+{
+  struct inode *ip, **pp;
+  struct ibucket *b;
+
+  for(;;){
+    acquire(&itable.lock);
+    if((ip = itable.free) != 0){
+      itable.free = ip->hnext;
+      itable.nfree--;
+      release(&itable.lock);
+      return ip;
+    }
+    if(itable.ninode < NINODE || itable.lrutail == 0){
+      release(&itable.lock);
+      igrow();
+      continue;
+    }
+
+    // Evict the least recently used entry. Its bucket lock
+    // must be taken first, so check again once holding it.
+    ip = itable.lrutail;
+    b = ibucket(ip->dev, ip->inum);
+    release(&itable.lock);
+    acquire(&b->lock);
+    acquire(&itable.lock);
+    if(ip == itable.lrutail && ibucket(ip->dev, ip->inum) == b){
+      lruremove(ip);
+      itable.evictions++;
+      release(&itable.lock);
+      for(pp = &b->head; *pp != ip; pp = &(*pp)->hnext)
+        ;
+      *pp = ip->hnext;
+      release(&b->lock);
+      return ip;
+    }
+    release(&itable.lock);
+    release(&b->lock);
   }
 }
 
 static struct inode* iget(uint dev, uint inum);
 
-// Allocate an inode on device dev.
+// Choose the block group for a new inode. Directories are
+// spread out: a new one goes to the group with the most free
+// blocks among those with at least the average number of free
+// inodes, or the most free inodes if that is a tie. Anything
+// else goes in the group of its parent directory, so a
+// directory's files and their data stay close.
+static uint
+igroup(short type, uint parent)
+{
+  uint g, best, avg;
+
+  best = IGROUP(parent, sb);
+  if(type != T_DIR)
+    return best;
+
+  acquire(&fsum.lock);
+  avg = 0;
+  for(g = 0; g < sb.ngroups; g++)
+    avg += fsum.ifree[g];
+  avg /= sb.ngroups;
+  for(g = 0; g < sb.ngroups; g++){
+    if(fsum.ifree[g] > 0 && fsum.ifree[g] >= avg &&
+       (fsum.ifree[best] == 0 || fsum.bfree[g] > fsum.bfree[best] ||
+        (fsum.bfree[g] == fsum.bfree[best] && fsum.ifree[g] > fsum.ifree[best])))
+      best = g;
+  }
+  release(&fsum.lock);
+  return best;
+}
+
+// Allocate an inode on device dev, in the group chosen by
+// igroup() for a child of directory inode parent, or the
+// next group after it with a free inode.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
 // or NULL if there is no free inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint parent)
 {
-  int inum;
+  uint start, g, k, i, bn, inum, nfree, hint, nib;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
+  nib = sb.ipg / IPB;
+  start = igroup(type, parent);
+  for(k = 0; k < sb.ngroups; k++){
+    g = (start + k) % sb.ngroups;
+    acquire(&fsum.lock);
+    nfree = fsum.ifree[g];
+    hint = fsum.ihint[g];
+    release(&fsum.lock);
+    if(nfree == 0)
+      continue;
+    // start at the hint, but wrap around in case a racing
+    // iput() freed an inode below it.
+    for(i = 0; i < nib; i++){
+      bn = GSTART(g, sb) + 1 + ((hint % sb.ipg) / IPB + i) % nib;
+      bp = bread(dev, bn);
+      for(dip = (struct dinode*)bp->data; dip < (struct dinode*)bp->data + IPB; dip++){
+        inum = g*sb.ipg + (bn - GSTART(g, sb) - 1)*IPB + (dip - (struct dinode*)bp->data);
+        if(inum > 0 && dip->type == 0){  // a free inode
+          memset(dip, 0, sizeof(*dip));
+          dip->type = type;
+          if(type != T_DEVICE)
+            dip->flags = DI_INLINE;
+          log_write(bp);   // mark it allocated on the disk
+          brelse(bp);
+          acquire(&fsum.lock);
+          fsum.ifree[g]--;
+          fsum.ihint[g] = inum + 1;
+          release(&fsum.lock);
+          return iget(dev, inum);
+        }
+      }
       brelse(bp);
-      return iget(dev, inum);
     }
-    brelse(bp);
   }
   printf("ialloc: no inodes\n");
   return 0;
 }
 
+// The size of ip as recorded on disk, which leaves out any
+// blocks waiting for allocation (see "Delayed allocation").
+static uint
+idisksize(struct inode *ip)
+{
+  if(ip->ndelay && ip->dfirst*BSIZE < ip->size)
+    return ip->dfirst*BSIZE;
+  return ip->size;
+}
+
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk.
@@ -228,16 +769,31 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
+  ip->lseq = log_seq();
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  dip->size = idisksize(ip);
+  dip->flags = ip->flags;
+  if(ip->flags & DI_INLINE){
+    memmove(dip->data, ip->data, NINLINE);
+  } else {
+    memmove(dip->ext, ip->ext, sizeof(dip->ext));
+    dip->extblock = ip->extblock;
+  }
   log_write(bp);
   brelse(bp);
+
+  if(ip->extdirty){
+    bp = bnew(ip->dev, ip->extblock);
+    memmove(bp->data, &ip->ext[NEXTENT], NINDEXTENT*sizeof(struct extent));
+    log_write(bp);
+    brelse(bp);
+    ip->extdirty = 0;
+  }
 }
 
 // Find the inode with number inum on device dev
@@ -246,32 +802,48 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
+  struct ibucket *b;
   struct inode *ip, *empty;
 
-  acquire(&itable.lock);
-
-  // Is the inode already in the table?
+  b = ibucket(dev, inum);
   empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
+  for(;;){
+    acquire(&b->lock);
+    b->gets += (empty == 0);
+
+    // Is the inode already in the table?
+    for(ip = b->head; ip; ip = ip->hnext){
+      if(ip->dev == dev && ip->inum == inum){
+        if(ip->ref++ == 0){
+          acquire(&itable.lock);
+          lruremove(ip);
+          release(&itable.lock);
+        }
+        b->hits++;
+        release(&b->lock);
+        if(empty)
+          ifree(empty);
+        return ip;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
+    if(empty)
+      break;
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    // Find a free entry without holding the bucket lock,
+    // then look again, since another process may have
+    // added the inode meanwhile.
+    release(&b->lock);
+    empty = inew();
+  }
 
   ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&itable.lock);
+  ip->hnext = b->head;
+  b->head = ip;
+  release(&b->lock);
 
   return ip;
 }
@@ -281,12 +853,36 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *b;
+
+  b = ibucket(ip->dev, ip->inum);
+  acquire(&b->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&b->lock);
   return ip;
 }
 
+// Copy the inode table's statistics to *st.
+void
+istat(struct istats *st)
+{
+  int i;
+
+  memset(st, 0, sizeof(*st));
+  for(i = 0; i < NIHASH; i++){
+    acquire(&itable.bucket[i].lock);
+    st->gets += itable.bucket[i].gets;
+    st->hits += itable.bucket[i].hits;
+    release(&itable.bucket[i].lock);
+  }
+  acquire(&itable.lock);
+  st->evictions = itable.evictions;
+  st->ninode = itable.ninode;
+  st->ncached = itable.nlru;
+  st->nactive = itable.ninode - itable.nlru - itable.nfree;
+  release(&itable.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -308,8 +904,29 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->flags = dip->flags;
+    memset(ip->ext, 0, sizeof(ip->ext));
+    ip->extblock = 0;
+    if(ip->flags & DI_INLINE){
+      memmove(ip->data, dip->data, NINLINE);
+    } else {
+      memmove(ip->ext, dip->ext, sizeof(dip->ext));
+      ip->extblock = dip->extblock;
+    }
     brelse(bp);
+    if(ip->extblock){
+      bp = bread(ip->dev, ip->extblock);
+      memmove(&ip->ext[NEXTENT], bp->data, NINDEXTENT*sizeof(struct extent));
+      brelse(bp);
+    }
+    for(ip->next = 0; ip->next < MAXEXTENT; ip->next++)
+      if(ip->ext[ip->next].len == 0)
+        break;
+    ip->extdirty = 0;
+    ip->ndelay = 0;
+    ip->dres = 0;
+    // its last change may still be in the open group.
+    ip->lseq = ip->dseq = log_seq();
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -330,13 +947,25 @@ iunlock(struct inode *ip)
 // If that was the last reference, the inode table entry can
 // be recycled.
 // If that was the last reference and the inode has no links
-// to it, free the inode (and its content) on disk.
-// All calls to iput() must be inside a transaction in
-// case it has to free the inode.
+// to it, free the inode (and its content) on disk, at once if
+// the caller is inside a transaction, else in the next one.
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *b;
+
+  b = ibucket(ip->dev, ip->inum);
+  acquire(&b->lock);
+
+  if(ip->ref == 1 && ip->valid && ip->nlink == 0 && !myproc()->fsop){
+    // the orphan list takes over the last reference.
+    release(&b->lock);
+    acquire(&orphans.lock);
+    ip->orphan = orphans.head;
+    orphans.head = ip;
+    release(&orphans.lock);
+    return;
+  }
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,20 +974,65 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&b->lock);
 
+    if(ip->type == T_DIR)
+      dcpurge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
+    acquire(&fsum.lock);
+    fsum.ifree[IGROUP(ip->inum, sb)]++;
+    if(ip->inum < fsum.ihint[IGROUP(ip->inum, sb)])
+      fsum.ihint[IGROUP(ip->inum, sb)] = ip->inum;
+    release(&fsum.lock);
+
     releasesleep(&ip->lock);
 
+    acquire(&b->lock);
+  }
+
+  if(--ip->ref == 0){
+    // blocks waiting for allocation point at ip.
+    if(ip->ndelay)
+      panic("iput: delayed blocks");
     acquire(&itable.lock);
+    lruadd(ip);
+    release(&itable.lock);
   }
+  release(&b->lock);
+}
 
-  ip->ref--;
-  release(&itable.lock);
+// Free the inodes on the orphan list, each in its own
+// transaction. Called by end_op(), outside any transaction.
+void
+ireap(void)
+{
+  struct inode *ip;
+
+  // an unlocked peek; an orphan added after it
+  // is freed by some later end_op().
+  if(orphans.head == 0)
+    return;
+
+  acquire(&orphans.lock);
+  if(orphans.reaping){
+    release(&orphans.lock);
+    return;
+  }
+  orphans.reaping = 1;
+  while((ip = orphans.head) != 0){
+    orphans.head = ip->orphan;
+    release(&orphans.lock);
+    begin_op();
+    iput(ip);
+    end_op();
+    acquire(&orphans.lock);
+  }
+  orphans.reaping = 0;
+  release(&orphans.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -372,86 +1046,731 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
-
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
-// returns 0 if out of disk space.
-static uint
-bmap(struct inode *ip, uint bn)
+// in blocks on the disk, described by a list of extents
+// sorted by file block number. The first NEXTENT extents
+// live in the inode itself, the next NINDEXTENT in block
+// ip->extblock. ilock() reads the whole list into ip->ext[],
+// so mapping a file block never reads more than the inode.
+
+// Return the index of the last extent in ip that starts at
+// or before file block bn, or -1 if there is none.
+static int
+extlookup(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
-
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
-    }
-    return addr;
-  }
-  bn -= NDIRECT;
-
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
-    }
-    brelse(bp);
-    return addr;
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = ip->next - 1;
+  while(lo <= hi){
+    mid = (lo + hi) / 2;
+    if(ip->ext[mid].lbn <= bn)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
   }
-
-  panic("bmap: out of range");
+  return hi;
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Extents up to and including j have changed; note whether
+// iupdate() has to rewrite ip->extblock, which holds those
+// from NEXTENT on.
+static void
+extchanged(struct inode *ip, int j)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  if(j >= NEXTENT)
+    ip->extdirty = 1;
+}
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+// Remove extent i from ip.
+static void
+extremove(struct inode *ip, int i)
+{
+  memmove(&ip->ext[i], &ip->ext[i+1], (ip->next-i-1)*sizeof(struct extent));
+  ip->next--;
+  memset(&ip->ext[ip->next], 0, sizeof(struct extent));
+  extchanged(ip, ip->next);
+}
+
+// Make room in ip for k more extents, keeping one for each
+// block waiting for allocation, and giving ip an extent block
+// if they need one. Returns -1 if there is no room.
+static int
+extroom(struct inode *ip, int k)
+{
+  if(ip->next + ip->ndelay + k > MAXEXTENT)
+    return -1;
+  if(ip->next + k > NEXTENT && ip->extblock == 0){
+    if((ip->extblock = bfirst(ip)) == 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Insert extent (lbn, bn, len) into ip at index i.
+// Caller has made room with extroom().
+static void
+extinsert(struct inode *ip, int i, uint lbn, uint bn, uint len)
+{
+  struct extent *e;
+
+  memmove(&ip->ext[i+1], &ip->ext[i], (ip->next-i)*sizeof(struct extent));
+  ip->next++;
+  e = &ip->ext[i];
+  e->lbn = lbn;
+  e->bn = bn;
+  e->len = len;
+  extchanged(ip, ip->next-1);
+}
+
+// Does written extent e end just before file block bn and
+// disk block addr?
+static int
+extbefore(struct extent *e, uint bn, uint addr)
+{
+  return !(e->len & EXT_UNWRITTEN) && e->lbn + e->len == bn && e->bn + e->len == addr;
+}
+
+// Does written extent f start just after file block bn and
+// disk block addr?
+static int
+extafter(struct extent *f, uint bn, uint addr)
+{
+  return !(f->len & EXT_UNWRITTEN) && f->lbn == bn + 1 && f->bn == addr + 1;
+}
+
+// Record that file block bn lives in disk block addr.
+// i is extlookup(ip, bn). Grows a neighbouring extent
+// if addr continues it; otherwise adds a new extent.
+// Returns -1 if the inode has no room for another extent.
+static int
+extadd(struct inode *ip, int i, uint bn, uint addr)
+{
+  struct extent *e, *f;
+
+  e = i >= 0 ? &ip->ext[i] : 0;
+  f = i+1 < ip->next ? &ip->ext[i+1] : 0;
+
+  if(e && extbefore(e, bn, addr)){
+    e->len++;
+    if(f && extafter(f, bn, addr)){
+      e->len += f->len;
+      extremove(ip, i+1);
+    }
+    extchanged(ip, i);
+  } else if(f && extafter(f, bn, addr)){
+    f->lbn--;
+    f->bn--;
+    f->len++;
+    extchanged(ip, i+1);
+  } else {
+    if(extroom(ip, 1) < 0)
+      return -1;
+    extinsert(ip, i+1, bn, addr, 1);
+  }
+  return 0;
+}
+
+// File block bn lies in unwritten extent i; it is about to be
+// written, so make it an ordinary block, splitting the extent,
+// or moving bn into a written neighbour if it is at one end.
+// Returns bn's disk block, or 0 if the inode has no room for
+// the extents a split makes.
+static uint
+extwrite(struct inode *ip, int i, uint bn)
+{
+  struct extent *e;
+  uint addr, pre, post;
+
+  e = &ip->ext[i];
+  addr = e->bn + (bn - e->lbn);
+  pre = bn - e->lbn;
+  post = EXTLEN(e) - pre - 1;
+
+  if(pre == 0 && i > 0 && extbefore(&ip->ext[i-1], bn, addr)){
+    ip->ext[i-1].len++;
+    e->lbn++;
+    e->bn++;
+    e->len--;
+    extchanged(ip, i);
+    if(post == 0)
+      extremove(ip, i);
+  } else if(post == 0 && i+1 < ip->next && extafter(&ip->ext[i+1], bn, addr)){
+    ip->ext[i+1].lbn--;
+    ip->ext[i+1].bn--;
+    ip->ext[i+1].len++;
+    e->len--;
+    extchanged(ip, i+1);
+    if(pre == 0)
+      extremove(ip, i);
+  } else if(pre == 0 && post == 0){
+    e->len = 1;
+    extchanged(ip, i);
+  } else if(pre == 0){
+    if(extroom(ip, 1) < 0)
+      return 0;
+    e->lbn++;
+    e->bn++;
+    e->len--;
+    extinsert(ip, i, bn, addr, 1);
+  } else if(post == 0){
+    if(extroom(ip, 1) < 0)
+      return 0;
+    e->len--;
+    extinsert(ip, i+1, bn, addr, 1);
+  } else {
+    if(extroom(ip, 2) < 0)
+      return 0;
+    e->len = pre | EXT_UNWRITTEN;
+    extinsert(ip, i+1, bn, addr, 1);
+    extinsert(ip, i+2, bn+1, addr+1, post | EXT_UNWRITTEN);
+  }
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one: next to the
+// file's preceding block when possible, otherwise near the
+// inode. An unwritten block becomes an ordinary, zeroed one.
+// If nrun is not 0, set *nrun to the number of blocks from bn
+// on that are contiguous on disk, so that callers can walk a
+// whole run with a single lookup.
+// returns 0 if out of disk space.
+static uint
+bmap(struct inode *ip, uint bn, uint *nrun)
+{
+  uint addr, goal;
+  struct extent *e;
+  int i;
+
+  if(bn >= MAXFILE)
+    panic("bmap: out of range");
+
+  i = extlookup(ip, bn);
+  if(i >= 0){
+    e = &ip->ext[i];
+    if(bn < e->lbn + EXTLEN(e)){
+      if(e->len & EXT_UNWRITTEN){
+        if((addr = extwrite(ip, i, bn)) == 0)
+          return 0;
+        bzero(ip->dev, addr);
+        if(nrun)
+          *nrun = 1;
+        return addr;
+      }
+      if(nrun)
+        *nrun = e->lbn + e->len - bn;
+      return e->bn + (bn - e->lbn);
+    }
+    goal = e->bn + (bn - e->lbn);
+    if(goal >= sb.size)
+      goal = e->bn + EXTLEN(e);  // far past the end, as a directory index is
+    addr = balloc(ip->dev, goal, BRUN);
+  } else {
+    addr = bfirst(ip);
+  }
+  if(addr == 0)
+    return 0;
+  if(extadd(ip, i, bn, addr) < 0){
+    bfree(ip->dev, addr, 1);
+    return 0;
+  }
+  if(nrun)
+    *nrun = 1;
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip,
+// or 0 if there is no such block or it is unwritten, setting
+// *nrun as bmap() does. Unlike bmap(), never allocates.
+static uint
+bmapped(struct inode *ip, uint bn, uint *nrun)
+{
+  int i;
+
+  i = extlookup(ip, bn);
+  if(i < 0 || bn >= ip->ext[i].lbn + EXTLEN(&ip->ext[i]) ||
+     (ip->ext[i].len & EXT_UNWRITTEN))
+    return 0;
+  if(nrun)
+    *nrun = ip->ext[i].lbn + ip->ext[i].len - bn;
+  return ip->ext[i].bn + (bn - ip->ext[i].lbn);
+}
+
+// Delayed allocation.
+//
+// A block that writei() adds to a regular file is not given a
+// place on disk right away. Its data waits in the buffer cache,
+// pinned, under block number DELAYED+i for slot i of dtab, and
+// breserve() sets a free block aside for it. iflush() later
+// allocates all of the file's waiting blocks together, as long
+// runs, and logs their data: filewrite() calls it when a file
+// has many waiting blocks, and fileclose() when a file that was
+// open for writing is closed. Until then the inode on disk
+// records a size that ends at the first waiting block, so a
+// crash loses the unflushed data but leaves a consistent file.
+//
+// A file only has waiting blocks while it is open for writing,
+// so its ip->ref keeps the inode in the table. dtab.lock
+// protects the table; ip->lock protects the file's entries in
+// it and ip->ndelay, ip->dfirst and ip->dres.
+
+#define DELAYED 0x80000000  // beyond any disk
+#define NDELAYI (NDELAY/2)  // max waiting blocks per file
+
+struct {
+  struct spinlock lock;
+  struct inode *ip[NDELAY];  // owner of each slot, or 0
+  uint lbn[NDELAY];          // and which of its blocks
+} dtab;
+
+static void
+dinit(void)
+{
+  initlock(&dtab.lock, "dtab");
+}
+
+// Return the buffer cache block number of ip's waiting
+// block bn, or 0 if bn is not waiting.
+static uint
+dlookup(struct inode *ip, uint bn)
+{
+  uint k;
+
+  if(ip->ndelay == 0)
+    return 0;
+  acquire(&dtab.lock);
+  for(k = 0; k < NDELAY; k++){
+    if(dtab.ip[k] == ip && dtab.lbn[k] == bn){
+      release(&dtab.lock);
+      return DELAYED + k;
     }
   }
+  release(&dtab.lock);
+  return 0;
+}
+
+// May ip's block bn, which has no place on disk, wait for
+// one? Not if fallocate() set a block aside for it, nor if
+// it is a hole inside the file's size on disk: that size
+// would have to shrink to end before it.
+static int
+dcandelay(struct inode *ip, uint bn)
+{
+  int i;
+
+  i = extlookup(ip, bn);
+  if(i >= 0 && bn < ip->ext[i].lbn + EXTLEN(&ip->ext[i]))
+    return 0;
+  return (uint64)bn*BSIZE >= idisksize(ip);
+}
+
+// Make ip's block bn a waiting block, with zeroed data.
+// Returns its buffer cache block number, or 0 if there is
+// no room, and the caller should allocate it now.
+static uint
+dalloc(struct inode *ip, uint bn)
+{
+  struct buf *bp;
+  uint k, need;
+
+  // each waiting block may become an extent.
+  if(ip->ndelay >= NDELAYI || ip->next + ip->ndelay >= MAXEXTENT)
+    return 0;
+  // the first also sets aside a block for ip->extblock.
+  need = ip->dres == 0 ? 2 : 1;
+  if(breserve(need) < 0)
+    return 0;
+  acquire(&dtab.lock);
+  for(k = 0; k < NDELAY; k++)
+    if(dtab.ip[k] == 0)
+      break;
+  if(k == NDELAY){
+    release(&dtab.lock);
+    bunreserve(need);
+    return 0;
+  }
+  dtab.ip[k] = ip;
+  dtab.lbn[k] = bn;
+  release(&dtab.lock);
+
+  ip->dres += need;
+  if(ip->ndelay == 0 || bn < ip->dfirst)
+    ip->dfirst = bn;
+  ip->ndelay++;
+  bp = bnew(ip->dev, DELAYED + k);
+  bpin(bp);
+  brelse(bp);
+  return DELAYED + k;
+}
+
+// Free slot k of dtab.
+static void
+dfree(struct inode *ip, uint k)
+{
+  struct buf *bp;
+
+  bp = bread(ip->dev, DELAYED + k);
+  bunpin(bp);
+  brelse(bp);
+  acquire(&dtab.lock);
+  dtab.ip[k] = 0;
+  release(&dtab.lock);
+}
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+// Discard ip's waiting blocks.
+static void
+ddrop(struct inode *ip)
+{
+  uint k;
+
+  if(ip->ndelay == 0)
+    return;
+  for(k = 0; k < NDELAY; k++)
+    if(dtab.ip[k] == ip)
+      dfree(ip, k);
+  bunreserve(ip->dres);
+  ip->ndelay = 0;
+  ip->dres = 0;
+}
+
+// Allocate disk blocks for ip's waiting blocks, lowest
+// first, as many as the transaction has room for, and log
+// their data. Caller must hold ip->lock and be in a
+// transaction.
+static void
+dflush(struct inode *ip)
+{
+  uint slot[NDELAYI], lbn[NDELAYI];
+  uint n, k, j, len, got, addr, goal, room;
+  struct buf *bp, *dbp;
+  int i;
+
+  // the file's slots, sorted by block.
+  n = 0;
+  acquire(&dtab.lock);
+  for(k = 0; k < NDELAY; k++){
+    if(dtab.ip[k] != ip)
+      continue;
+    for(j = n; j > 0 && lbn[j-1] > dtab.lbn[k]; j--){
+      lbn[j] = lbn[j-1];
+      slot[j] = slot[j-1];
+    }
+    lbn[j] = dtab.lbn[k];
+    slot[j] = k;
+    n++;
+  }
+  release(&dtab.lock);
+
+  // a run of blocks costs a bitmap block too; leave room
+  // for the inode, and the extent block and its bitmap block.
+  room = MAXOPBLOCKS - 3;
+  for(k = 0; k < n && room >= 2; k += got){
+    for(len = 1; k+len < n && lbn[k+len] == lbn[k]+len && len+1 < room; len++)
+      ;
+
+    // a new extent from here on needs the extent block.
+    if(ip->next >= NEXTENT && ip->extblock == 0){
+      if((ip->extblock = brun(ip->dev, bhint(ip), 1, &got)) == 0)
+        panic("dflush: extblock");
+      bhintpast(ip, ip->extblock, 1);
+      ip->dres--;
+      ip->extdirty = 1;
     }
+
+    i = extlookup(ip, lbn[k]);
+    if(i >= 0){
+      goal = ip->ext[i].bn + (lbn[k] - ip->ext[i].lbn);
+      if(goal >= sb.size)
+        goal = ip->ext[i].bn + EXTLEN(&ip->ext[i]);
+    } else {
+      goal = bhint(ip);
+    }
+    if((addr = brun(ip->dev, goal, len, &got)) == 0)
+      panic("dflush: out of blocks");
+    if(i < 0)
+      bhintpast(ip, addr, got);
+    ip->dres -= got;
+    room -= got + 1;
+
+    for(j = k; j < k + got; j++){
+      ip->ndelay--;  // frees the extent kept for it
+      if(extadd(ip, extlookup(ip, lbn[j]), lbn[j], addr + j - k) < 0)
+        panic("dflush: extadd");
+      dbp = bread(ip->dev, DELAYED + slot[j]);
+      bp = bnew(ip->dev, addr + j - k);
+      memmove(bp->data, dbp->data, BSIZE);
+      log_write(bp);
+      brelse(bp);
+      brelse(dbp);
+      dfree(ip, slot[j]);
+    }
+  }
+
+  if(ip->ndelay == 0){
+    bunreserve(ip->dres);
+    ip->dres = 0;
+  } else {
+    ip->dfirst = lbn[k];
+  }
+  ip->dseq = log_seq();
+  iupdate(ip);
+}
+
+// If more than max of ip's blocks are waiting for disk
+// blocks, allocate all of them, in as many transactions as
+// that takes. Caller must not hold ip->lock or be in a
+// transaction.
+void
+iflush(struct inode *ip, uint max)
+{
+  int more;
+
+  // an unlocked peek; a file only gains waiting blocks
+  // from its writers, one of which is the caller.
+  if(ip->ndelay <= max)
+    return;
+  do {
+    begin_op();
+    ilock(ip);
+    if(ip->nlink == 0)
+      ddrop(ip);  // no one will see them
+    else if(ip->ndelay > 0)
+      dflush(ip);
+    more = ip->ndelay > 0;
+    iunlock(ip);
+    end_op();
+  } while(more);
+}
+
+// Move the inline content of ip out to a data block, as it
+// is about to grow past NINLINE bytes.
+static int
+iexpand(struct inode *ip)
+{
+  struct buf *bp;
+  uint addr;
+
+  ip->flags &= ~DI_INLINE;
+  if(ip->size > 0){
+    if((addr = bmap(ip, 0, 0)) == 0){
+      ip->flags |= DI_INLINE;
+      return -1;
+    }
+    bp = bread(ip->dev, addr);
+    memmove(bp->data, ip->data, ip->size);
+    log_write(bp);
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  memset(ip->data, 0, NINLINE);
+  return 0;
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip)
+{
+  int i;
+
+  ddrop(ip);
+
+  for(i = 0; i < ip->next; i++)
+    bfree(ip->dev, ip->ext[i].bn, EXTLEN(&ip->ext[i]));
+  memset(ip->ext, 0, sizeof(ip->ext));
+  ip->next = 0;
+
+  if(ip->extblock){
+    bfree(ip->dev, ip->extblock, 1);
+    ip->extblock = 0;
+  }
+  ip->extdirty = 0;
+
+  // an empty file starts out inline again.
+  if(ip->type != T_DEVICE)
+    ip->flags |= DI_INLINE;
+  memset(ip->data, 0, NINLINE);
 
   ip->size = 0;
+  ip->dseq = log_seq();
   iupdate(ip);
 }
 
+// Preallocation and hole punching, for fallocate().
+
+#define FALLOCRUNS (MAXOPBLOCKS-4)  // runs set aside per transaction
+#define PUNCHMAX (8*BPB)            // blocks freed per transaction
+
+// Set disk blocks aside for ip's bytes off..off+n-1 that have
+// none, as unwritten extents, in runs as long as the free space
+// allows. Stops after FALLOCRUNS runs, each of which may change
+// a bitmap block, to fit in a transaction. Returns the number of
+// bytes from off on that are done, or -1 if there is no disk
+// space, or no room for another extent.
+// Caller must hold ip->lock and be in a transaction.
+int
+ifalloc(struct inode *ip, uint off, uint n)
+{
+  uint bn, nb, b, done, m, got, addr, goal;
+  int i, runs;
+  struct extent *e;
+
+  if(ip->type != T_FILE)
+    return -1;
+  if(n == 0)
+    return 0;
+  if((ip->flags & DI_INLINE) && iexpand(ip) < 0)
+    return -1;
+
+  bn = off / BSIZE;
+  nb = (off + n - 1) / BSIZE - bn + 1;
+  done = 0;
+  runs = 0;
+  while(done < nb && runs < FALLOCRUNS){
+    b = bn + done;
+    i = extlookup(ip, b);
+    if(i >= 0 && b < ip->ext[i].lbn + EXTLEN(&ip->ext[i])){
+      done += min(nb - done, ip->ext[i].lbn + EXTLEN(&ip->ext[i]) - b);
+      continue;
+    }
+
+    // the gap runs to the next extent, or the next waiting block.
+    m = min(nb - done, BPG);
+    if(i+1 < ip->next && ip->ext[i+1].lbn - b < m)
+      m = ip->ext[i+1].lbn - b;
+    for(got = 0; got < m && dlookup(ip, b + got) == 0; got++)
+      ;
+    if(got == 0){
+      done++;
+      continue;
+    }
+    for(m = got; m > 0; m /= 2)
+      if(breserve(m) == 0)
+        break;
+    if(m == 0)
+      return -1;
+
+    goal = i >= 0 ? ip->ext[i].bn + (b - ip->ext[i].lbn) : bhint(ip);
+    if((addr = brun(ip->dev, goal, m, &got)) == 0){
+      bunreserve(m);
+      return -1;
+    }
+    bunreserve(m - got);
+    if(i < 0)
+      bhintpast(ip, addr, got);
+    runs++;
+
+    e = i >= 0 ? &ip->ext[i] : 0;
+    if(e && (e->len & EXT_UNWRITTEN) &&
+       e->lbn + EXTLEN(e) == b && e->bn + EXTLEN(e) == addr){
+      e->len += got;
+      extchanged(ip, i);
+    } else {
+      if(extroom(ip, 1) < 0){
+        bfree(ip->dev, addr, got);
+        return -1;
+      }
+      extinsert(ip, i+1, b, addr, got | EXT_UNWRITTEN);
+    }
+    done += got;
+  }
+  ip->dseq = log_seq();
+  iupdate(ip);
+  return min(n, (bn + done)*BSIZE - off);
+}
+
+// Zero ip's bytes off..off+n-1, which lie in one block.
+static void
+izero(struct inode *ip, uint off, uint n)
+{
+  struct buf *bp;
+  uint addr;
+
+  // a hole or an unwritten block reads as zeros already.
+  if((addr = bmapped(ip, off/BSIZE, 0)) == 0 &&
+     (addr = dlookup(ip, off/BSIZE)) == 0)
+    return;
+  bp = bread(ip->dev, addr);
+  memset(bp->data + off%BSIZE, 0, n);
+  if(addr < DELAYED)
+    log_write(bp);
+  brelse(bp);
+}
+
+// Punch a hole in ip's bytes off..off+n-1: free the blocks
+// that lie wholly inside it and zero the rest. A waiting block
+// is zeroed rather than freed. Stops at the end of an extent or
+// after PUNCHMAX blocks, to fit in a transaction. Returns the
+// number of bytes from off on that are done, or -1 if there is
+// no room for the extent that splitting one makes.
+// Caller must hold ip->lock and be in a transaction.
+int
+ipunch(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, b, s, t, len, flag;
+  struct extent *e;
+  int i;
+
+  if(ip->type != T_FILE)
+    return -1;
+  if(n == 0)
+    return 0;
+  if(ip->flags & DI_INLINE){
+    if(off < NINLINE)
+      memset(ip->data + off, 0, min(n, NINLINE - off));
+    ip->dseq = log_seq();
+    iupdate(ip);
+    return n;
+  }
+  if(off % BSIZE != 0 || n < BSIZE){
+    n = min(n, BSIZE - off%BSIZE);
+    izero(ip, off, n);
+    return n;
+  }
+
+  bn = off / BSIZE;
+  end = bn + n / BSIZE;
+  i = extlookup(ip, bn);
+  if(i < 0 || bn >= ip->ext[i].lbn + EXTLEN(&ip->ext[i]))
+    i++;
+  if(i >= ip->next || ip->ext[i].lbn > bn){
+    // no extent until ext[i].
+    t = i < ip->next && ip->ext[i].lbn < end ? ip->ext[i].lbn : end;
+    for(b = bn; b < t && ip->ndelay > 0; b++)
+      izero(ip, b*BSIZE, BSIZE);
+    return (t - bn)*BSIZE;
+  }
+
+  e = &ip->ext[i];
+  len = EXTLEN(e);
+  flag = e->len & EXT_UNWRITTEN;
+  s = bn;
+  t = min(min(end, e->lbn + len), bn + PUNCHMAX);
+  if(s == e->lbn && t == e->lbn + len){
+    bfree(ip->dev, e->bn, len);
+    extremove(ip, i);
+  } else if(s == e->lbn){
+    bfree(ip->dev, e->bn, t - s);
+    e->bn += t - s;
+    e->lbn = t;
+    e->len -= t - s;
+    extchanged(ip, i);
+  } else if(t == e->lbn + len){
+    bfree(ip->dev, e->bn + (s - e->lbn), t - s);
+    e->len -= t - s;
+    extchanged(ip, i);
+  } else {
+    if(extroom(ip, 1) < 0)
+      return -1;
+    extinsert(ip, i+1, t, e->bn + (t - e->lbn), (e->lbn + len - t) | flag);
+    bfree(ip->dev, e->bn + (s - e->lbn), t - s);
+    e->len = (s - e->lbn) | flag;
+    extchanged(ip, i);
+  }
+  ip->dseq = log_seq();
+  iupdate(ip);
+  return (t - bn)*BSIZE;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -464,6 +1783,8 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+static char zeroes[BSIZE];  // what a hole reads as
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -471,7 +1792,7 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, nrun;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -479,18 +1800,39 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->flags & DI_INLINE){
+    if(either_copyout(user_dst, dst, ip->data + off, n) == -1)
+      return -1;
+    return n;
+  }
+
+  addr = 0;
+  nrun = 0;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
+    // only look up the block map at the start of each run.
+    if(nrun == 0){
+      if((addr = bmapped(ip, off/BSIZE, &nrun)) == 0){
+        addr = dlookup(ip, off/BSIZE);  // or 0 for a hole
+        nrun = 1;
+      }
+    }
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if(addr == 0){
+      if(either_copyout(user_dst, dst, zeroes, m) == -1) {
+        tot = -1;
+        break;
+      }
+    } else {
+      bp = bread(ip->dev, addr);
+      if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+        brelse(bp);
+        tot = -1;
+        break;
+      }
       brelse(bp);
-      tot = -1;
-      break;
+      addr++;
     }
-    brelse(bp);
+    nrun--;
   }
   return tot;
 }
@@ -505,25 +1847,54 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, dsize;
+  int delayed, dirty;
   struct buf *bp;
 
-  if(off > ip->size || off + n < off)
+  // writing past the end of a regular file leaves a hole.
+  if((off > ip->size && ip->type != T_FILE) || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if((uint64)off + n > (uint64)MAXFILE*BSIZE)
     return -1;
 
+  if(ip->flags & DI_INLINE){
+    if(off + n <= NINLINE){
+      if(either_copyin(ip->data + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      ip->dseq = log_seq();
+      iupdate(ip);
+      return n;
+    }
+    if(iexpand(ip) < 0)
+      return -1;
+  }
+
+  dsize = idisksize(ip);
+  dirty = 0;
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
+    // a new block of a regular file waits for iflush() to
+    // give it a place on disk, if there is room.
+    delayed = 0;
+    if((addr = bmapped(ip, off/BSIZE, 0)) == 0){
+      if(ip->type == T_FILE &&
+         ((addr = dlookup(ip, off/BSIZE)) != 0 ||
+          (dcandelay(ip, off/BSIZE) && (addr = dalloc(ip, off/BSIZE)) != 0)))
+        delayed = 1;
+      else if((addr = bmap(ip, off/BSIZE, 0)) == 0)
+        break;
+    }
     bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(!delayed){
+      log_write(bp);
+      dirty = 1;
+    }
     brelse(bp);
   }
 
@@ -532,9 +1903,100 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
-  iupdate(ip);
+  // block to ip->ext[]. A write that only went to blocks waiting
+  // for allocation changes nothing on disk yet.
+  if(dirty || idisksize(ip) != dsize){
+    ip->dseq = log_seq();
+    iupdate(ip);
+  }
+
+  return tot;
+}
 
+// Direct I/O (O_DIRECT).
+//
+// Whole blocks of a file go straight between the disk and the
+// user pages, by DMA, without a trip through the buffer cache.
+// The pages cannot go away meanwhile, since they belong to the
+// process making the system call. A block the cache must still
+// handle goes through readi() or writei(): the partial block at
+// either end of the transfer, a block waiting for allocation,
+// and all of an inline file.
+
+// Read like readi(), into user address dst.
+// Caller must hold ip->lock.
+int
+readidirect(struct inode *ip, uint64 dst, uint off, uint n)
+{
+  uint tot, m, addr;
+  uint64 pa;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  if((ip->flags & DI_INLINE) || off % BSIZE != 0 || dst % BSIZE != 0)
+    return readi(ip, 1, dst, off, n);
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, BSIZE);
+    if(m < BSIZE || (addr = bmapped(ip, off/BSIZE, 0)) == 0){
+      if(readi(ip, 1, dst, off, m) != m)
+        return -1;
+      continue;
+    }
+    if((pa = useraddr(myproc()->pagetable, dst, 1)) == 0)
+      return -1;
+    breaddirect(ip->dev, addr, pa);
+  }
+  return tot;
+}
+
+// Write like writei(), from user address src. A new block is
+// allocated at once, rather than left waiting for allocation,
+// so that its contents can go straight to it.
+// Caller must hold ip->lock and be in a transaction.
+int
+writeidirect(struct inode *ip, uint64 src, uint off, uint n)
+{
+  uint tot, m, addr;
+  uint64 pa;
+  int dirty;
+
+  if((off > ip->size && ip->type != T_FILE) || off + n < off)
+    return -1;
+  if((uint64)off + n > (uint64)MAXFILE*BSIZE)
+    return -1;
+  if((ip->flags & DI_INLINE) || ip->type != T_FILE ||
+     off % BSIZE != 0 || src % BSIZE != 0)
+    return writei(ip, 1, src, off, n);
+
+  dirty = 0;
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    m = min(n - tot, BSIZE);
+    if(m < BSIZE || dlookup(ip, off/BSIZE) != 0){
+      if(writei(ip, 1, src, off, m) != m)
+        break;
+      continue;
+    }
+    if((pa = useraddr(myproc()->pagetable, src, 0)) == 0)
+      break;
+    if((addr = bmapped(ip, off/BSIZE, 0)) == 0){
+      if((addr = bmap(ip, off/BSIZE, 0)) == 0)
+        break;
+      dirty = 1;
+    }
+    bwritedirect(ip->dev, addr, pa);
+    if(off + m > ip->size){
+      ip->size = off + m;
+      dirty = 1;
+    }
+  }
+
+  if(dirty){
+    ip->dseq = log_seq();
+    iupdate(ip);
+  }
   return tot;
 }
 
@@ -546,17 +2008,283 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
+// Hash a directory entry name (FNV-1a).
+static uint
+namehash(const char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Return a locked buffer with the root block of directory
+// dp's hash index, or 0 if dp has no index. A zeroed root
+// is left behind if building the index ran out of blocks.
+static struct buf*
+dirindex(struct inode *dp)
+{
+  struct buf *bp;
+  uint addr, magic;
+
+  if((addr = bmapped(dp, DIRIDX, 0)) == 0)
+    return 0;
+  bp = bread(dp->dev, addr);
+  magic = ((struct dirroot*)bp->data)->magic;
+  if(magic == 0){
+    brelse(bp);
+    return 0;
+  }
+  if(magic != DIRMAGIC)
+    panic("dirindex: bad root");
+  return bp;
+}
+
+// Return a locked buffer with index block DIRIDX+n of dp.
+static struct buf*
+dirbread(struct inode *dp, uint n)
+{
+  uint addr;
+
+  if((addr = bmapped(dp, DIRIDX + n, 0)) == 0)
+    panic("dirbread");
+  return bread(dp->dev, addr);
+}
+
+// Allocate a new, zeroed index block for dp and return it
+// locked, setting *n to its number.
+static struct buf*
+dirballoc(struct inode *dp, struct dirroot *root, uint *n)
+{
+  uint addr;
+
+  if(root->nblk >= MAXFILE - DIRIDX || root->nblk > 0xffff)
+    return 0;
+  if((addr = bmap(dp, DIRIDX + root->nblk, 0)) == 0)
+    return 0;
+  iupdate(dp);
+  *n = root->nblk++;
+  return bread(dp->dev, addr);
+}
+
+static int dirhadd(struct inode*, struct dirroot*, uint, uint);
+
+// Give directory dp a hash index: a root, and one leaf for
+// every name, then index the entries dp already has. Called
+// when dp's entries move out of its inode, so there are few.
+static int
+dirmkindex(struct inode *dp)
+{
+  struct buf *bp, *lbp;
+  struct dirroot *root;
+  struct dirent de;
+  uint addr, n, off;
+
+  if((addr = bmap(dp, DIRIDX, 0)) == 0)
+    return -1;
+  bp = bread(dp->dev, addr);
+  root = (struct dirroot*)bp->data;
+  root->nblk = 1;
+  if((lbp = dirballoc(dp, root, &n)) == 0){
+    brelse(bp);
+    return -1;
+  }
+  root->leaf[0] = n;
+  log_write(lbp);
+  brelse(lbp);
+  root->hole = dp->size/sizeof(de);
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirmkindex: readi");
+    if(de.inum == 0){
+      root->nhole++;
+      if(off/sizeof(de) < root->hole)
+        root->hole = off/sizeof(de);
+    } else if(dirhadd(dp, root, namehash(de.name), off/sizeof(de)) < 0){
+      brelse(bp);
+      return -1;
+    }
+  }
+  root->magic = DIRMAGIC;
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Split the full leaf block n, held locked in lbp, moving the
+// entries whose next hash bit is set to a new leaf. Doubles
+// the root's table first if the leaf already uses all of it.
+// Returns 0 if it could not split, and the caller should
+// chain an overflow block instead.
+static int
+dirsplit(struct inode *dp, struct dirroot *root, uint n, struct buf *lbp)
+{
+  struct dirleaf *l, *nl;
+  struct buf *nbp;
+  uint nn, bit, i, j;
+
+  l = (struct dirleaf*)lbp->data;
+  if(l->next != 0)
+    return 0;
+  if(l->depth == root->depth){
+    if(root->depth == DIRDEPTH)
+      return 0;
+    for(i = 0; i < (1 << root->depth); i++)
+      root->leaf[i + (1 << root->depth)] = root->leaf[i];
+    root->depth++;
+  }
+  if((nbp = dirballoc(dp, root, &nn)) == 0)
+    return 0;
+  nl = (struct dirleaf*)nbp->data;
+
+  bit = 1 << l->depth;
+  l->depth++;
+  nl->depth = l->depth;
+  for(i = j = 0; i < l->n; i++){
+    if(l->ent[i].hash & bit)
+      nl->ent[nl->n++] = l->ent[i];
+    else
+      l->ent[j++] = l->ent[i];
+  }
+  l->n = j;
+  for(i = 0; i < (1 << root->depth); i++)
+    if(root->leaf[i] == n && (i & bit))
+      root->leaf[i] = nn;
+
+  log_write(nbp);
+  brelse(nbp);
+  log_write(lbp);
+  return 1;
+}
+
+// Add an index entry for dirent number slot, whose name
+// hashes to h. root is dp's locked index root; the caller
+// writes it.
+static int
+dirhadd(struct inode *dp, struct dirroot *root, uint h, uint slot)
+{
+  struct buf *bp, *nbp;
+  struct dirleaf *l;
+  uint n, nn;
+
+  n = root->leaf[h & ((1 << root->depth) - 1)];
+  bp = dirbread(dp, n);
+  l = (struct dirleaf*)bp->data;
+  while(l->n == NDIRHENT){
+    if(dirsplit(dp, root, n, bp)){
+      // the entry may now belong in the new leaf.
+      if(root->leaf[h & ((1 << root->depth) - 1)] != n){
+        brelse(bp);
+        n = root->leaf[h & ((1 << root->depth) - 1)];
+        bp = dirbread(dp, n);
+        l = (struct dirleaf*)bp->data;
+      }
+      continue;
+    }
+    if(l->next == 0){
+      if((nbp = dirballoc(dp, root, &nn)) == 0){
+        brelse(bp);
+        return -1;
+      }
+      l->next = nn;
+      ((struct dirleaf*)nbp->data)->depth = l->depth;
+      log_write(bp);
+      brelse(nbp);
+    }
+    n = l->next;
+    brelse(bp);
+    bp = dirbread(dp, n);
+    l = (struct dirleaf*)bp->data;
+  }
+
+  l->ent[l->n].hash = h;
+  l->ent[l->n].slot = slot;
+  l->n++;
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Remove the index entry for dirent number slot, whose name
+// hashes to h.
+static void
+dirhremove(struct inode *dp, struct dirroot *root, uint h, uint slot)
+{
+  struct buf *bp;
+  struct dirleaf *l;
+  uint n;
+  int i;
+
+  n = root->leaf[h & ((1 << root->depth) - 1)];
+  do {
+    bp = dirbread(dp, n);
+    l = (struct dirleaf*)bp->data;
+    for(i = 0; i < l->n; i++){
+      if(l->ent[i].slot == slot){
+        l->ent[i] = l->ent[--l->n];
+        log_write(bp);
+        brelse(bp);
+        return;
+      }
+    }
+    n = l->next;
+    brelse(bp);
+  } while(n != 0);
+  panic("dirhremove");
+}
+
+// Look for a directory entry in a directory, and remember
+// the answer in the name cache.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, h, n;
   struct dirent de;
+  struct buf *bp;
+  struct dirroot *root;
+  struct dirleaf *l;
+  int i;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  // Look in the index, unless the directory is small
+  // enough that reading it all is just as quick.
+  if(dp->size > BSIZE && (bp = dirindex(dp)) != 0){
+    h = namehash(name);
+    root = (struct dirroot*)bp->data;
+    n = root->leaf[h & ((1 << root->depth) - 1)];
+    brelse(bp);
+    do {
+      bp = dirbread(dp, n);
+      l = (struct dirleaf*)bp->data;
+      for(i = 0; i < l->n; i++){
+        if(l->ent[i].hash != h)
+          continue;
+        off = l->ent[i].slot * sizeof(de);
+        if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+          panic("dirlookup read");
+        if(de.inum != 0 && namecmp(name, de.name) == 0){
+          brelse(bp);
+          if(poff)
+            *poff = off;
+          dcput(dp, name, de.inum);
+          return iget(dp->dev, de.inum);
+        }
+      }
+      n = l->next;
+      brelse(bp);
+    } while(n != 0);
+    dcput(dp, name, 0);
+    return 0;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +2295,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcput(dp, name, inum);
       return iget(dp->dev, inum);
     }
   }
 
+  dcput(dp, name, 0);
   return 0;
 }
 
@@ -579,9 +2309,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off;
+  int reuse, inl;
   struct dirent de;
   struct inode *ip;
+  struct buf *bp;
+  struct dirroot *root;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -589,22 +2322,298 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  bp = dirindex(dp);
+  root = bp ? (struct dirroot*)bp->data : 0;
+
+  // Look for an empty dirent. The index knows whether there
+  // is one, and where to start looking.
+  off = 0;
+  if(root)
+    off = root->nhole ? root->hole*sizeof(de) : dp->size;
+  for(; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
       break;
   }
+  reuse = off < dp->size;
 
+  if(off >= DIRIDX*BSIZE)
+    goto bad;
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
+  inl = dp->flags & DI_INLINE;
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    goto bad;
+
+  // A directory that outgrows its inode gets an index. If
+  // there are no blocks for one it stays a linear directory.
+  if(inl && (dp->flags & DI_INLINE) == 0)
+    dirmkindex(dp);
+
+  if(root){
+    if(reuse){
+      root->nhole--;
+      root->hole = off/sizeof(de) + 1;
+    }
+    if(dirhadd(dp, root, namehash(name), off/sizeof(de)) < 0){
+      // out of blocks for the index; take the dirent back.
+      memset(&de, 0, sizeof(de));
+      if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink: writei");
+      root->nhole++;
+      if(off/sizeof(de) < root->hole)
+        root->hole = off/sizeof(de);
+      log_write(bp);
+      goto bad;
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+  dcput(dp, name, inum);
+  return 0;
+
+ bad:
+  if(bp)
+    brelse(bp);
+  return -1;
+}
+
+// Remove the directory entry at byte offset off in dp.
+void
+dirunlink(struct inode *dp, uint off)
+{
+  struct dirent de;
+  struct buf *bp;
+  struct dirroot *root;
+
+  if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink: readi");
+  if((bp = dirindex(dp)) != 0){
+    root = (struct dirroot*)bp->data;
+    dirhremove(dp, root, namehash(de.name), off/sizeof(de));
+    root->nhole++;
+    if(off/sizeof(de) < root->hole)
+      root->hole = off/sizeof(de);
+    log_write(bp);
+    brelse(bp);
+  }
+
+  dcput(dp, de.name, 0);
+  memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink: writei");
+}
+
+// Read up to n entries of directory dp into di, starting at
+// byte offset *off and skipping empty slots, and advance *off
+// past them. Returns the number of entries, 0 at the end of
+// the directory, or -1 if dp is not a directory.
+// dp must not be locked.
+int
+dirread(struct inode *dp, uint *off, struct dirinfo *di, int n)
+{
+  struct inode *ip[NDIRREAD];
+  struct dirent de;
+  int i, k;
+
+  if(n > NDIRREAD)
+    n = NDIRREAD;
+
+  // Take a reference to each entry's inode while dp is locked,
+  // so that an unlink cannot free it before we look at it,
+  // but lock the inodes only after dp is unlocked, as namex()
+  // does, since one of them may be dp's parent.
+  ilock(dp);
+  if(dp->type != T_DIR){
+    iunlock(dp);
     return -1;
+  }
+  k = 0;
+  while(k < n && *off + sizeof(de) <= dp->size){
+    if(readi(dp, 0, (uint64)&de, *off, sizeof(de)) != sizeof(de))
+      panic("dirread");
+    *off += sizeof(de);
+    if(de.inum == 0)
+      continue;
+    di[k].inum = de.inum;
+    memmove(di[k].name, de.name, DIRSIZ);
+    ip[k++] = iget(dp->dev, de.inum);
+  }
+  iunlock(dp);
+
+  for(i = 0; i < k; i++){
+    ilock(ip[i]);
+    di[i].type = ip[i]->type;
+    di[i].size = ip[i]->size;
+    iunlockput(ip[i]);
+  }
+  return k;
+}
 
+// Name cache.
+//
+// Remembers recent directory lookups as (directory, name) ->
+// inode number, including names that were not found, so that
+// namex() can walk a familiar path without locking or reading
+// each directory along the way.
+//
+// Entries are only added or changed by dirlookup(), dirlink()
+// and dirunlink(), whose callers hold the directory's lock, so
+// an entry always agrees with the directory. Readers need only
+// dcache.lock, under which dcget() also takes its reference to
+// a found inode: the entry is dropped by dirunlink() before
+// the inode can lose its last link, so the inode cannot be
+// freed and reused in between.
+//
+// The least recently used entry is reused for a new one.
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dinum;             // directory; 0 if entry unused
+  char name[DIRSIZ];
+  uint inum;              // 0 if name is not in the directory
+  struct dentry *hnext;   // hash chain
+  struct dentry *prev;    // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDENTRY];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct dentry head;
+} dcache;
+
+static void
+dcinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.ent; d < dcache.ent+NDENTRY; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static struct dentry**
+dchash(uint dev, uint dinum, char *name)
+{
+  return &dcache.hash[(namehash(name) ^ dinum ^ dev) % NDHASH];
+}
+
+// Find the entry for name in directory (dev, dinum).
+// Caller must hold dcache.lock.
+static struct dentry*
+dcfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dchash(dev, dinum, name); d; d = d->hnext)
+    if(d->dinum == dinum && d->dev == dev && namecmp(d->name, name) == 0)
+      return d;
   return 0;
 }
 
+// Unhash d and move it to the end of the LRU list, unused.
+// Caller must hold dcache.lock.
+static void
+dcdrop(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dchash(d->dev, d->dinum, d->name); *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dinum = 0;
+
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->prev = dcache.head.prev;
+  d->next = &dcache.head;
+  dcache.head.prev->next = d;
+  dcache.head.prev = d;
+}
+
+// Move d to the front of the LRU list.
+// Caller must hold dcache.lock.
+static void
+dctouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Record that name in directory dp is inode inum, or is
+// absent if inum is 0. Caller must hold dp->lock.
+static void
+dcput(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    d = dcache.head.prev;
+    if(d->dinum != 0)
+      dcdrop(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->hnext = *dchash(d->dev, d->dinum, d->name);
+    *dchash(d->dev, d->dinum, d->name) = d;
+  }
+  d->inum = inum;
+  dctouch(d);
+  release(&dcache.lock);
+}
+
+// Look up name in directory dp in the name cache, without
+// locking dp. If the answer is known, return 1 and set *ipp
+// to the referenced inode, or to 0 if name is absent.
+// Returns 0 if the cache does not know.
+static int
+dcget(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dctouch(d);
+  *ipp = d->inum ? iget(d->dev, d->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Forget all entries for directory dp, which is being freed.
+static void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent+NDENTRY; d++)
+    if(d->dinum == dp->inum && d->dev == dp->dev)
+      dcdrop(d);
+  release(&dcache.lock);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -644,21 +2653,30 @@ skipelem(char *path, char *name)
   return path;
 }
 
-// Look up and return the inode for a path name.
+// Look up and return the inode for a path name, relative to
+// directory dp or, if dp is 0, the current directory.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
-// Must be called inside a transaction since it calls iput().
 static struct inode*
-namex(char *path, int nameiparent, char *name)
+namex(struct inode *dp, char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
+  else if(dp)
+    ip = idup(dp);
   else
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(!(nameiparent && *path == '\0') && dcget(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -687,11 +2705,18 @@ struct inode*
 namei(char *path)
 {
   char name[DIRSIZ];
-  return namex(path, 0, name);
+  return namex(0, path, 0, name);
+}
+
+struct inode*
+nameiat(struct inode *dp, char *path)
+{
+  char name[DIRSIZ];
+  return namex(dp, path, 0, name);
 }
 
 struct inode*
 nameiparent(char *path, char *name)
 {
-  return namex(path, 1, name);
+  return namex(0, path, 1, name);
 }
@@ -6,27 +6,60 @@
 #define BSIZE 1024  // block size
 
 // Disk layout:
-// [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+// [ boot block | super block | log | group 0 | group 1 | ... ]
+//
+// The rest of the disk is divided into block groups of BPG blocks
+// (the last one may be shorter). Each group has its own free bit map
+// and slice of the inode table, so that files can be kept close to
+// their inodes and directories:
+// [ free bit map block | inode blocks | data blocks ]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
 struct superblock {
   uint magic;        // Must be FSMAGIC
+  uint version;      // Must be FSVERSION
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
   uint nlog;         // Number of log blocks
   uint logstart;     // Block number of first log block
-  uint inodestart;   // Block number of first inode block
-  uint bmapstart;    // Block number of first free map block
+  uint groupstart;   // Block number of first block group
+  uint ngroups;      // Number of block groups
+  uint ipg;          // Inodes per group (a multiple of IPB)
 };
 
 #define FSMAGIC 0x10203040
+#define FSVERSION 5  // 2: extent-mapped inodes, 3: block groups,
+                     // 4: 128-byte inodes with inline data,
+                     // 5: unwritten extents and holes
+
+// A file's content is a list of extents, sorted by file block
+// number. Each extent maps len consecutive file blocks, starting
+// at file block lbn, to len consecutive disk blocks starting at bn.
+struct extent {
+  uint lbn;             // First file block covered
+  uint bn;              // First disk block
+  uint len;             // Number of blocks
+};
+
+// An unwritten extent holds blocks that fallocate() set aside
+// but nothing has written yet; they read as zeros. A file block
+// that no extent covers is a hole, and reads as zeros too.
+#define EXT_UNWRITTEN 0x80000000  // flag in len
+#define EXTLEN(e) ((e)->len & ~EXT_UNWRITTEN)
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NEXTENT 9
+#define NINDEXTENT (BSIZE / sizeof(struct extent))
+#define MAXEXTENT (NEXTENT + NINDEXTENT)
+#define MAXFILE (1 << 21)  // max file blocks; keeps byte offsets in a uint
+
+// A small file's content is kept in the dinode itself, in the
+// space that would otherwise hold its extents, saving a block
+// and a disk read. It moves out to a block when it grows past
+// NINLINE bytes.
+#define DI_INLINE 0x1   // content is in dinode.data
+#define NINLINE (NEXTENT*sizeof(struct extent) + sizeof(uint))
 
 // On-disk inode structure
 struct dinode {
@@ -35,20 +68,45 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // DI_INLINE
+  union {
+    struct {
+      struct extent ext[NEXTENT]; // First extents
+      uint extblock;        // Block holding the remaining extents, or 0
+    };
+    uchar data[NINLINE];  // Content, if DI_INLINE
+  };
 };
 
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
-// Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
-
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
+// Blocks per group: one free map block covers a group.
+#define BPG           BPB
+
+// First block of group g
+#define GSTART(g, sb)     ((sb).groupstart + (g)*BPG)
+
+// First data block of group g
+#define GDATA(g, sb)      (GSTART(g, sb) + 1 + (sb).ipg/IPB)
+
+// Group containing block b
+#define BGROUP(b, sb)     (((b) - (sb).groupstart) / BPG)
+
+// Group holding inode i
+#define IGROUP(i, sb)     ((i) / (sb).ipg)
+
+// Block containing inode i
+#define IBLOCK(i, sb)     (GSTART(IGROUP(i, sb), sb) + 1 + (i) % (sb).ipg / IPB)
+
 // Block of free map containing bit for block b
-#define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
+#define BBLOCK(b, sb)     GSTART(BGROUP(b, sb), sb)
+
+// Bit for block b within its free map block
+#define BBIT(b, sb)       (((b) - (sb).groupstart) % BPG)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
@@ -58,3 +116,56 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory entry as getdents() returns it, with the type
+// and size of the inode it names, so that listing a directory
+// does not take a stat() per entry.
+struct dirinfo {
+  uint inum;
+  uint size;
+  short type;
+  char name[DIRSIZ];
+};
+
+
+// A directory created by the kernel also has a hash index, so
+// that names can be found without reading every dirent. The
+// dirents stay where they always were, at the start of the
+// file; the index lives in file blocks from DIRIDX on, past
+// the directory's size, where reads of the directory do not
+// see it. Directories without an index (such as those made
+// by mkfs) are searched linearly.
+//
+// The index is an extendible hash table: the root maps the low
+// depth bits of a name's hash to the leaf block holding the
+// entries for such names. A full leaf is split in two, doubling
+// the root's table first if needed; once the table is as big as
+// it can get, full leaves grow overflow chains instead.
+#define DIRIDX     (MAXFILE/2)  // file block of the index root
+#define DIRMAGIC   0x44495248   // "HRID"
+#define DIRDEPTH   8            // max depth of the root's table
+
+// Index root block.
+struct dirroot {
+  uint magic;                // DIRMAGIC
+  uint depth;                // hash bits used to pick a leaf
+  uint nblk;                 // index blocks, including this one
+  uint nhole;                // empty dirent slots below size
+  uint hole;                 // no empty slot below this one
+  ushort leaf[1<<DIRDEPTH];  // leaf for each hash, as block - DIRIDX
+};
+
+// Index entry: a dirent slot whose name hashes to hash.
+struct dirhent {
+  uint hash;
+  uint slot;                 // dirent number, offset/sizeof(struct dirent)
+};
+
+#define NDIRHENT ((BSIZE - 3*sizeof(uint)) / sizeof(struct dirhent))
+
+// Index leaf block.
+struct dirleaf {
+  uint depth;                // entries agree in this many low hash bits
+  uint n;                    // entries in use
+  uint next;                 // overflow block, as block - DIRIDX, or 0
+  struct dirhent ent[NDIRHENT];
+};
@@ -0,0 +1,148 @@
+//
+// Inter-processor interrupts.
+//
+// A CPU interrupts another by writing the other's CLINT MSIP
+// register. timervec in kernelvec.S turns that into a
+// supervisor software interrupt, and devintr() calls ipiintr()
+// to handle the messages that each CPU has waiting for it.
+//
+// Messages that say only "do this once more", like a request
+// to reschedule, are bits in a mask, so that repeats fold
+// together. Requests that the sender waits for, like a TLB
+// flush, go in a small queue with a flag to set when done. A
+// sender waits for one such request at a time, so the queue
+// never holds more than one per other CPU.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define IPI_RESCHED 0x1   // see if something better should run
+
+#define NIPIMSG NCPU
+
+struct ipimsg {
+  int *done;        // set to 1 once handled
+};
+
+struct ipiq {
+  struct spinlock lock;
+  int pending;                  // IPI_* bits
+  struct ipimsg msg[NIPIMSG];   // TLB flushes
+  uint nread;                   // number of messages handled
+  uint nwrite;                  // number of messages queued
+} ipiq[NCPU];
+
+void
+ipiinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&ipiq[i].lock, "ipiq");
+}
+
+static void
+ipisend(int cpu)
+{
+  __sync_synchronize();
+  *(volatile uint32*)CLINT_MSIP(cpu) = 1;
+}
+
+// Wake CPU cpu from idle(). It has no message to handle;
+// the interrupt alone brings it out of wfi.
+void
+ipiwake(int cpu)
+{
+  ipisend(cpu);
+}
+
+// Ask CPU cpu to check whether the process it is running
+// should give way to one that has become RUNNABLE.
+void
+ipiresched(int cpu)
+{
+  struct ipiq *q = &ipiq[cpu];
+
+  acquire(&q->lock);
+  if(q->pending & IPI_RESCHED){
+    // it has yet to look since the last request.
+    release(&q->lock);
+    return;
+  }
+  q->pending |= IPI_RESCHED;
+  release(&q->lock);
+  ipisend(cpu);
+}
+
+// Handle this CPU's queued TLB flushes.
+static void
+ipiflush(struct ipiq *q)
+{
+  int *done[NIPIMSG];
+  int i, n;
+
+  acquire(&q->lock);
+  for(n = 0; q->nread != q->nwrite; n++)
+    done[n] = q->msg[q->nread++ % NIPIMSG].done;
+  release(&q->lock);
+  if(n == 0)
+    return;
+  sfence_vma();
+  for(i = 0; i < n; i++)
+    __atomic_store_n(done[i], 1, __ATOMIC_RELEASE);
+}
+
+// Flush the TLBs of all other CPUs that have started, and wait
+// until they have, after changing a page table that they might
+// have cached entries from. The caller flushes its own.
+void
+tlbshootdown(void)
+{
+  struct ipiq *q;
+  int done[NCPU], i, me;
+
+  push_off();
+  me = cpuid();
+  for(i = 0; i < NCPU; i++){
+    done[i] = 1;
+    if(i == me || cpus[i].start == 0)
+      continue;
+    done[i] = 0;
+    q = &ipiq[i];
+    acquire(&q->lock);
+    if(q->nwrite - q->nread == NIPIMSG)
+      panic("tlbshootdown");
+    q->msg[q->nwrite++ % NIPIMSG].done = &done[i];
+    release(&q->lock);
+    ipisend(i);
+  }
+  for(i = 0; i < NCPU; i++){
+    // handle flushes asked of this CPU meanwhile, since
+    // another CPU may be waiting for this one to do so.
+    while(__atomic_load_n(&done[i], __ATOMIC_ACQUIRE) == 0)
+      ipiflush(&ipiq[me]);
+  }
+  pop_off();
+}
+
+// Handle the messages waiting for this CPU.
+// Returns 1 if it has been asked to reschedule.
+int
+ipiintr(void)
+{
+  struct ipiq *q = &ipiq[cpuid()];
+  int pending;
+
+  ipiflush(q);
+  acquire(&q->lock);
+  pending = q->pending;
+  q->pending = 0;
+  release(&q->lock);
+  return (pending & IPI_RESCHED) != 0;
+}
@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -29,6 +30,21 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Transaction groups are numbered. Normally each group commits as
+// soon as its last system call ends. In asynchronous mode (see
+// log_async()) end_op() leaves the group open in memory until the
+// log is nearly full or log_force() asks for it, so that repeated
+// writes to the same blocks are absorbed and a write() returns
+// without waiting for the disk. An inode remembers the group of
+// its last change, so fsync() only waits for that group. A
+// kernel thread commits an open group once it is LOGFLUSHTICKS
+// old, so that a crash loses no more than that much work. It
+// runs only in asynchronous mode, exiting when the mode is
+// turned off, and sets no timer while there is nothing for it
+// to commit, so that an idle CPU is left alone.
+
+#define LOGFLUSHTICKS 10
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,6 +59,11 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int async;       // leave groups open after end_op()
+  int flusher;     // logflusher() is running
+  int force;       // log_force() is waiting; last end_op() must commit
+  uint seq;        // number of the open transaction group
+  uint committed;  // number of the last group on disk
   int dev;
   struct logheader lh;
 };
@@ -50,6 +71,7 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logflusher(void*);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,6 +83,7 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
 }
 
@@ -136,6 +159,7 @@ begin_op(void)
     } else {
       log.outstanding += 1;
       release(&log.lock);
+      myproc()->fsop = 1;
       break;
     }
   }
@@ -148,18 +172,24 @@ end_op(void)
 {
   int do_commit = 0;
 
+  myproc()->fsop = 0;
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 &&
+     (!log.async || log.force || log.lh.n + MAXOPBLOCKS > LOGSIZE)){
     do_commit = 1;
     log.committing = 1;
+    log.force = 0;
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
     // the amount of reserved space.
     wakeup(&log);
+    // the group stays open: logflusher() must commit it.
+    if(log.async && log.lh.n > 0)
+      wakeup(&log.async);
   }
   release(&log.lock);
 
@@ -169,9 +199,108 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
+    log.committed = log.seq++;
     wakeup(&log);
     release(&log.lock);
   }
+
+  // free inodes that lost their last reference outside a
+  // transaction.
+  ireap();
+}
+
+// Number of the open transaction group, which holds the
+// changes made by the caller's current FS system call.
+uint
+log_seq(void)
+{
+  return log.seq;
+}
+
+// Wait until transaction group seq, and every group before it,
+// is on disk, committing the open group if need be.
+void
+log_force(uint seq)
+{
+  acquire(&log.lock);
+  while(log.committed < seq){
+    if(log.committing || log.outstanding > 0){
+      // the last end_op() will commit.
+      log.force = 1;
+      sleep(&log, &log.lock);
+    } else {
+      log.committing = 1;
+      release(&log.lock);
+      commit();
+      acquire(&log.lock);
+      log.committing = 0;
+      log.committed = log.seq++;
+      wakeup(&log);
+    }
+  }
+  release(&log.lock);
+}
+
+// Kernel thread: commit any group left open in asynchronous
+// mode once it has had LOGFLUSHTICKS to gather more writes.
+// Returns, and so exits, once asynchronous mode is off.
+static void
+logflusher(void *arg)
+{
+  uint seq;
+
+  for(;;){
+    acquire(&log.lock);
+    while(log.async && log.lh.n == 0)
+      sleep(&log.async, &log.lock);
+    if(!log.async){
+      log.flusher = 0;
+      release(&log.lock);
+      return;
+    }
+    seq = log.seq;
+    release(&log.lock);
+    ticksleep(LOGFLUSHTICKS);
+    acquire(&log.lock);
+    if(!log.async || log.lh.n == 0 || log.committed >= seq)
+      seq = 0;
+    release(&log.lock);
+    if(seq)
+      log_force(seq);
+  }
+}
+
+// Turn asynchronous commit on (1) or off (0), or leave it be
+// (-1), returning the old setting, or -1 if there is no
+// memory for logflusher(). Turning it on starts logflusher(),
+// unless it is still running; turning it off commits the open
+// group, and logflusher() exits.
+int
+log_async(int on)
+{
+  int old, start;
+  uint seq;
+
+  acquire(&log.lock);
+  old = log.async;
+  if(on >= 0)
+    log.async = on;
+  start = log.async && !log.flusher;
+  if(start)
+    log.flusher = 1;
+  wakeup(&log.async);
+  seq = log.seq;
+  release(&log.lock);
+  if(start && kthread_create(logflusher, 0, "logflush") < 0){
+    acquire(&log.lock);
+    log.flusher = 0;
+    log.async = old;
+    release(&log.lock);
+    return -1;
+  }
+  if(on == 0)
+    log_force(seq);
+  return old;
 }
 
 // Copy modified blocks from cache to log.
@@ -1,13 +1,21 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         3  // scheduling priority levels
+#define NSCHED        2  // scheduling classes
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // in-memory i-nodes to keep before reusing unused ones
+#define NDENTRY     128  // size of name lookup cache
+#define NDIRREAD     16  // directory entries getdents() reads at a time
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define MAXOPBLOCKS  20  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define NDELAY       32  // file blocks waiting for disk allocation
+#define NBUF         (MAXOPBLOCKS*3+NDELAY)  // size of disk block cache
+#ifndef FSSIZE
+#define FSSIZE       20000  // size of file system in blocks
+#endif
+#define NINODES      12000   // number of inodes in file system
 #define MAXPATH      128   // maximum file path name
@@ -3,20 +3,56 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "sched.h"
+#include "stat.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// Processes.
+//
+// struct procs come from a slab: pages carved into as many
+// as fit, each with a kernel stack mapped at KSTACK() of its
+// number. slab[i] holds procs i*PROCSPERPAGE and up, and is
+// allocated once the pages below it are all in use, up to
+// NPROC. New procs come from the lowest page with one UNUSED,
+// so that the higher pages empty once a burst of forks is
+// over; a page whose procs are all UNUSED is then given back,
+// stacks and all. The first, which procinit() allocates for
+// init and the shell, is kept.
+
+#define PROCSPERPAGE (PGSIZE / sizeof(struct proc))
+#define NSLAB ((NPROC + PROCSPERPAGE - 1) / PROCSPERPAGE)
+
+struct slab {
+  struct proc *procs;         // the page, or 0
+  struct proc *free;          // its UNUSED procs
+  int nused;                  // ... and how many are not
+};
+
+struct spinlock proc_lock;    // protects slab[]'s free and nused
+struct slab slab[NSLAB];
+struct sleeplock growlock;    // protects slab[]'s procs
 
 struct proc *initproc;
 
+// Live processes, by pid, so that kill() and the like find
+// one without looking at them all. pid_lock protects the
+// hash chains; it comes before p->lock. A bucket for every
+// few procs keeps the chains short when the table is full.
+#define NPIDHASH (NPROC/4)
+
 int nextpid = 1;
 struct spinlock pid_lock;
+struct proc *pidhash[NPIDHASH];
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void procput(struct proc *p);
+static void runqput(struct proc *p);
+static void addchild(struct proc *p, struct proc *c);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,37 +62,165 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// Wait queues: each sleeping process is on the queue of the
+// bucket its chan hashes to, so that wakeup() only looks at
+// processes sleeping on chans with the same hash.
+#define NSLEEPQ 31
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+// How many procs slab page s holds; the last may hold fewer.
+static int
+slabsize(struct slab *s)
+{
+  int base = (s - slab) * PROCSPERPAGE;
+
+  if(NPROC - base < PROCSPERPAGE)
+    return NPROC - base;
+  return PROCSPERPAGE;
+}
+
+// Unmap and free the first n kernel stacks of slab page s.
+// No spinlock may be held, for tlbshootdown().
+static void
+freestacks(struct slab *s, int n)
+{
+  char *pa[PROCSPERPAGE];
+  int base = (s - slab) * PROCSPERPAGE;
+  int i;
+
+  for(i = 0; i < n; i++)
+    pa[i] = kvmunstack(KSTACK(base + i));
+
+  // no CPU may go on using a stale mapping to a freed page.
+  sfence_vma();
+  tlbshootdown();
+  for(i = 0; i < n; i++)
+    kfree(pa[i]);
+}
+
+// Add a page of procs to the slab, each with a kernel stack
+// mapped high in memory, followed by an invalid guard page.
+// Caller must hold growlock, or be alone at boot.
+// Returns 0 if the slab is full or memory is short.
+static int
+growslab(void)
+{
+  struct proc *p, *page, *free;
+  struct slab *s;
+  int i, n, base;
+
+  for(s = slab; s < &slab[NSLAB] && s->procs; s++)
+    ;
+  if(s == &slab[NSLAB] || (page = (struct proc*)kalloc()) == 0)
+    return 0;
+  memset(page, 0, PGSIZE);
+  base = (s - slab) * PROCSPERPAGE;
+  n = slabsize(s);
+  for(i = 0; i < n; i++){
+    if(kvmstack(KSTACK(base + i)) < 0){
+      freestacks(s, i);
+      kfree(page);
+      return 0;
+    }
+  }
+
+  // the stacks are new mappings in the kernel page table,
+  // which every CPU shares.
+  sfence_vma();
+  tlbshootdown();
+
+  free = 0;
+  for(i = n-1; i >= 0; i--){
+    p = &page[i];
+    initlock(&p->lock, "proc");
+    p->state = UNUSED;
+    p->kstack = KSTACK(base + i);
+    p->slab = s;
+    p->freenext = free;
+    free = p;
+  }
+  acquire(&proc_lock);
+  s->procs = page;
+  s->free = free;
+  s->nused = 0;
+  release(&proc_lock);
+  return 1;
+}
+
+// Give back slab page s, whose procs are all UNUSED and
+// which procput() has taken off the free lists.
+static void
+shrinkslab(struct slab *s)
+{
+  acquiresleep(&growlock);
+  freestacks(s, slabsize(s));
+  kfree((void*)s->procs);
+  acquire(&proc_lock);
+  s->procs = 0;
+  release(&proc_lock);
+  releasesleep(&growlock);
+}
+
+// Take an UNUSED proc from the lowest slab page that has one,
+// or return 0.
+static struct proc*
+slaballoc(void)
 {
   struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    // KSTACK分配了两个页的大小，但是只使用了一个kalloc，所以有一个页是没有被映射的。
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  struct slab *s;
+
+  acquire(&proc_lock);
+  for(s = slab; s < &slab[NSLAB]; s++){
+    if((p = s->free) != 0){
+      s->free = p->freenext;
+      s->nused++;
+      release(&proc_lock);
+      return p;
+    }
   }
+  release(&proc_lock);
+  return 0;
+}
+
+// Grow the slab for a process that has found it empty.
+static int
+procgrow(void)
+{
+  struct slab *s;
+  int n;
+
+  acquiresleep(&growlock);
+  // another may have grown it, or freed a proc, meanwhile.
+  acquire(&proc_lock);
+  for(s = slab; s < &slab[NSLAB] && s->free == 0; s++)
+    ;
+  release(&proc_lock);
+  n = s < &slab[NSLAB] ? 1 : growslab();
+  releasesleep(&growlock);
+  return n;
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
+  struct cpu *c;
+  int i;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  initlock(&proc_lock, "proc_lock");
+  initsleeplock(&growlock, "procgrow");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rqlock, "runq");
+  for(i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
+  if(growslab() == 0)
+    panic("procinit");
 }
 
 // Must be called with interrupts disabled,
@@ -90,46 +254,117 @@ myproc(void)
   return p;
 }
 
-int
-allocpid()
+// Give p, fresh from the slab, a pid and hash it. It stays
+// invisible to pidlookup() until no longer UNUSED.
+static void
+allocpid(struct proc *p)
 {
-  int pid;
-  
+  struct proc **h;
+
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  h = &pidhash[(uint)p->pid % NPIDHASH];
+  p->pidnext = *h;
+  *h = p;
   release(&pid_lock);
+}
 
-  return pid;
+// Take p's pid out of the hash, once it is UNUSED. Caller
+// must not hold p->lock, which comes after pid_lock.
+static void
+freepid(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[(uint)p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pid_lock);
+  p->pid = 0;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// Find the live process with the given pid and return it
+// with p->lock held, or return 0. No process has a pid of
+// 0 or less.
 static struct proc*
-allocproc(void)
+pidlookup(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  if(pid <= 0)
+    return 0;
+  acquire(&pid_lock);
+  for(p = pidhash[(uint)pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  if(p){
+    // holding pid_lock until p is known to be live keeps
+    // procput() from giving its slab page back meanwhile.
     acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
+    if(p->state == UNUSED){
       release(&p->lock);
+      p = 0;
     }
   }
-  return 0;
+  release(&pid_lock);
+  return p;
+}
+
+// Take an UNUSED proc from the slab, growing it if need be.
+// If found, initialize state required to run in the kernel,
+// with no user memory, and return with p->lock held.
+// If there are no free procs, return 0.
+static struct proc*
+allockproc(void)
+{
+  struct proc *p;
+
+  while((p = slaballoc()) == 0)
+    if(procgrow() == 0)
+      return 0;
 
-found:
-  p->pid = allocpid();
+  allocpid(p);
+  acquire(&p->lock);
   p->state = USED;
+  p->cpu = cpuid();
+  p->prio = p->level = p->used = 0;
+  p->boost = 0;
+  p->sclass = SCHED_MLFQ;
+  p->weight = SCHED_WEIGHT;
+  p->vruntime = p->runtime = 0;
+  p->theap = -1;
+  p->kthread = 0;
+
+  // Set up new context to start executing at forkret,
+  // which returns to user space.
+  memset(&p->context, 0, sizeof(p->context));
+  p->context.ra = (uint64)forkret;
+  p->context.sp = p->kstack + PGSIZE;
+
+  return p;
+}
+
+// Allocate a process as allockproc() does, with a trapframe and
+// an empty user page table, ready for user memory.
+// If there are no free procs, or a memory allocation fails, return 0.
+static struct proc*
+allocproc(void)
+{
+  struct proc *p;
+
+  if((p = allockproc()) == 0)
+    return 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
     freeproc(p);
     release(&p->lock);
+    procput(p);
     return 0;
   }
 
@@ -138,21 +373,61 @@ found:
   if(p->pagetable == 0){
     freeproc(p);
     release(&p->lock);
+    procput(p);
     return 0;
   }
 
-  // Set up new context to start executing at forkret,
-  // which returns to user space.
-  memset(&p->context, 0, sizeof(p->context));
-  p->context.ra = (uint64)forkret;
-  p->context.sp = p->kstack + PGSIZE;
-
   return p;
 }
 
-// free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// A kernel thread's first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn(p->karg);
+  exit(0);
+}
+
+// Create a kernel thread, a process with no user memory that
+// runs fn(arg) in supervisor mode and exits when fn returns.
+// It may sleep like any process. Its parent is init, which
+// reaps it. Returns its pid, or -1.
+int
+kthread_create(void (*fn)(void*), void *arg, char *name)
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allockproc()) == 0)
+    return -1;
+  p->kthread = 1;
+  p->kfn = fn;
+  p->karg = arg;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  release(&p->lock);
+
+  acquire(&wait_lock);
+  addchild(initproc, p);
+  release(&wait_lock);
+
+  acquire(&p->lock);
+  runqput(p);
+  release(&p->lock);
+
+  return pid;
+}
+
+// free the data hanging from a proc structure, including
+// user pages, and make it UNUSED. p->lock must be held;
+// the caller releases it and then calls procput().
 static void
 freeproc(struct proc *p)
 {
@@ -163,7 +438,6 @@ freeproc(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
-  p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
@@ -172,6 +446,27 @@ freeproc(struct proc *p)
   p->state = UNUSED;
 }
 
+// Return p, which freeproc() has made UNUSED, to the slab,
+// giving back its page if no proc on it is in use. No
+// spinlock may be held, for shrinkslab().
+static void
+procput(struct proc *p)
+{
+  struct slab *s = p->slab;
+  int empty;
+
+  freepid(p);
+  acquire(&proc_lock);
+  p->freenext = s->free;
+  s->free = p;
+  empty = --s->nused == 0 && s != slab;
+  if(empty)
+    s->free = 0;
+  release(&proc_lock);
+  if(empty)
+    shrinkslab(s);
+}
+
 // Create a user page table for a given process, with no user memory,
 // but with trampoline and trapframe pages.
 pagetable_t
@@ -250,7 +545,7 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runqput(p);
 
   release(&p->lock);
 }
@@ -293,6 +588,7 @@ fork(void)
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
     freeproc(np);
     release(&np->lock);
+    procput(np);
     return -1;
   }
   np->sz = p->sz;
@@ -311,21 +607,36 @@ fork(void)
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->prio = np->level = p->prio;
+  np->sclass = p->sclass;
+  np->weight = p->weight;
+  np->vruntime = p->vruntime;
+
   pid = np->pid;
 
   release(&np->lock);
 
   acquire(&wait_lock);
-  np->parent = p;
+  addchild(p, np);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runqput(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Make c a child of p.
+// Caller must hold wait_lock.
+static void
+addchild(struct proc *p, struct proc *c)
+{
+  c->parent = p;
+  c->sibling = p->children;
+  p->children = c;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -333,12 +644,13 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  while((pp = p->children) != 0){
+    p->children = pp->sibling;
+    addchild(initproc, pp);
   }
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -361,9 +673,8 @@ exit(int status)
     }
   }
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
+  if(p->cwd)
+    iput(p->cwd);
   p->cwd = 0;
 
   acquire(&wait_lock);
@@ -391,37 +702,36 @@ exit(int status)
 int
 wait(uint64 addr)
 {
-  struct proc *pp;
+  struct proc *pp, **ppp;
   int havekids, pid;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    // Scan through the children looking for exited ones.
+    havekids = p->children != 0;
+    for(ppp = &p->children; (pp = *ppp) != 0; ppp = &pp->sibling){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        *ppp = pp->sibling;
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        procput(pp);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -435,10 +745,468 @@ wait(uint64 addr)
   }
 }
 
+// Run queues.
+//
+// Each CPU has run queues of RUNNABLE processes for each
+// scheduling class. Its scheduler() asks the classes in turn,
+// SCHED_MLFQ first, for a process to run, except that a
+// SCHED_FAIR process that has waited FAIRSTARVE ticks goes
+// first, so that SCHED_MLFQ spinners cannot starve it. A
+// SCHED_FAIR process is picked from all CPUs' queues. A process that
+// becomes RUNNABLE joins the queues of the CPU it last ran on,
+// where its cache may still be warm; a new one joins those of
+// the CPU that created it. A CPU with empty queues takes work
+// from the others'. A process is on a queue exactly when it is
+// RUNNABLE. Lock order: p->lock, then the queue's.
+
+// A scheduling class. enqueue, dequeue and peek are called
+// with c->rqlock held, enqueue and tick with p->lock held.
+struct schedclass {
+  void (*enqueue)(struct cpu *c, struct proc *p);
+  struct proc* (*dequeue)(struct cpu *c);
+  // the process dequeue would return, left on the queue.
+  struct proc* (*peek)(struct cpu *c);
+  // should p, of this class, run before q, also of it?
+  int (*before)(struct proc *p, struct proc *q);
+  // p has run for another tick; is its time up?
+  int (*tick)(struct proc *p);
+};
+
+// SCHED_MLFQ: a multi-level feedback queue.
+//
+// There is a queue for each of NPRIO levels, and the first
+// process of the highest level (lowest number) runs first. A
+// process starts at level p->prio. Once it has run for its
+// level's quantum, counting every tick it has had there, it
+// moves down a level, so that CPU-bound processes sink below
+// those that mostly sleep. Every BOOSTTICKS ticks, everything
+// moves back up to its p->prio, so that nothing starves.
+
+#define BOOSTTICKS 20
+
+static int quantum[NPRIO] = { 1, 2, 4 };  // ticks
+
+// Number of the latest priority boost.
+static uint
+boostnum(void)
+{
+  return ticknow() / BOOSTTICKS;
+}
+
+// Move p back up to its starting level if there has been a
+// boost since it last looked. Caller must hold p->lock.
+static void
+boostproc(struct proc *p)
+{
+  uint b = boostnum();
+
+  if(p->boost != b){
+    p->boost = b;
+    p->level = p->prio;
+    p->used = 0;
+  }
+}
+
+static void
+mlfqput(struct cpu *c, struct proc *p, int level)
+{
+  p->rqnext = 0;
+  if(c->rqtail[level])
+    c->rqtail[level]->rqnext = p;
+  else
+    c->rqhead[level] = p;
+  c->rqtail[level] = p;
+}
+
+static void
+mlfqenqueue(struct cpu *c, struct proc *p)
+{
+  boostproc(p);
+  mlfqput(c, p, p->level);
+}
+
+// Move every process on c's queues to the queue for its
+// starting level.
+static void
+mlfqboost(struct cpu *c)
+{
+  struct proc *list[NPRIO], *p;
+  int i;
+
+  for(i = 0; i < NPRIO; i++){
+    list[i] = c->rqhead[i];
+    c->rqhead[i] = c->rqtail[i] = 0;
+  }
+  for(i = 0; i < NPRIO; i++){
+    while((p = list[i]) != 0){
+      list[i] = p->rqnext;
+      // p->prio is p's to change; a stale level does no harm.
+      mlfqput(c, p, p->prio);
+    }
+  }
+}
+
+static struct proc*
+mlfqdequeue(struct cpu *c)
+{
+  struct proc *p;
+  int i;
+
+  if(c->boost != boostnum()){
+    c->boost = boostnum();
+    mlfqboost(c);
+  }
+  for(i = 0; i < NPRIO; i++){
+    if((p = c->rqhead[i]) != 0){
+      c->rqhead[i] = p->rqnext;
+      if(c->rqhead[i] == 0)
+        c->rqtail[i] = 0;
+      return p;
+    }
+  }
+  return 0;
+}
+
+static struct proc*
+mlfqpeek(struct cpu *c)
+{
+  int i;
+
+  for(i = 0; i < NPRIO; i++)
+    if(c->rqhead[i])
+      return c->rqhead[i];
+  return 0;
+}
+
+static int
+mlfqbefore(struct proc *p, struct proc *q)
+{
+  return p->level < q->level;
+}
+
+// Has p used up its quantum? If so, move it down a level.
+static int
+mlfqtick(struct proc *p)
+{
+  boostproc(p);
+  if(++p->used >= quantum[p->level]){
+    if(p->level < NPRIO-1)
+      p->level++;
+    p->used = 0;
+    return 1;
+  }
+  return 0;
+}
+
+// SCHED_FAIR: proportional share.
+//
+// A process's vruntime grows as it runs, by the time it ran
+// scaled down by its weight, and the process with the least
+// runs next; so over time each gets CPU in proportion to its
+// weight. vruntimes are on one scale for all CPUs: each CPU
+// queues its own, but picks the least of all their heads (see
+// fairget()), and a running process gives way to a smaller
+// one anywhere, so the shares hold across CPUs and a process
+// keeps its vruntime when it moves. A process that has slept
+// starts no further back than fairmin, so it cannot make up
+// for lost time by hogging the CPU.
+
+#define FAIRSTARVE 20   // ticks a SCHED_FAIR queue may wait
+
+static uint64 fairmin;  // largest vruntime taken off any queue
+
+static void
+fairenqueue(struct cpu *c, struct proc *p)
+{
+  struct proc **pp;
+  uint64 min;
+
+  min = __atomic_load_n(&fairmin, __ATOMIC_RELAXED);
+  if(p->vruntime < min)
+    p->vruntime = min;
+  if(c->fairq == 0)
+    c->fairlast = ticknow();
+  for(pp = &c->fairq; *pp && (*pp)->vruntime <= p->vruntime; pp = &(*pp)->rqnext)
+    ;
+  p->rqnext = *pp;
+  *pp = p;
+}
+
+static struct proc*
+fairdequeue(struct cpu *c)
+{
+  struct proc *p;
+  uint64 min;
+
+  if((p = c->fairq) != 0){
+    c->fairq = p->rqnext;
+    c->fairlast = ticknow();
+    min = __atomic_load_n(&fairmin, __ATOMIC_RELAXED);
+    while(p->vruntime > min &&
+          !__atomic_compare_exchange_n(&fairmin, &min, p->vruntime, 0,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+  }
+  return p;
+}
+
+static struct proc*
+fairpeek(struct cpu *c)
+{
+  return c->fairq;
+}
+
+static int
+fairbefore(struct proc *p, struct proc *q)
+{
+  return p->vruntime < q->vruntime;
+}
+
+// p runs until another has run less, with no fixed quantum.
+static int
+fairtick(struct proc *p)
+{
+  return 0;
+}
+
+static struct schedclass schedclass[NSCHED] = {
+[SCHED_MLFQ] { mlfqenqueue, mlfqdequeue, mlfqpeek, mlfqbefore, mlfqtick },
+[SCHED_FAIR] { fairenqueue, fairdequeue, fairpeek, fairbefore, fairtick },
+};
+
+// Should p run before q?
+static int
+runsbefore(struct proc *p, struct proc *q)
+{
+  if(p->sclass != q->sclass)
+    return p->sclass < q->sclass;
+  return schedclass[p->sclass].before(p, q);
+}
+
+// The CPU whose SCHED_FAIR queue's head has the least vruntime,
+// or 0 if all are empty; *vr is set to that vruntime.
+static struct cpu*
+fairbest(uint64 *vr)
+{
+  struct cpu *oc, *best;
+  struct proc *q;
+
+  best = 0;
+  for(oc = cpus; oc < &cpus[NCPU]; oc++){
+    // an unlocked peek, as in runqget().
+    if(__atomic_load_n(&oc->nqueued[SCHED_FAIR], __ATOMIC_RELAXED) == 0)
+      continue;
+    acquire(&oc->rqlock);
+    if((q = oc->fairq) != 0 && (best == 0 || q->vruntime < *vr)){
+      best = oc;
+      *vr = q->vruntime;
+    }
+    release(&oc->rqlock);
+  }
+  return best;
+}
+
+// Has c's SCHED_FAIR queue waited FAIRSTARVE ticks?
+// Caller must hold c->rqlock.
+static int
+fairstarved(struct cpu *c)
+{
+  return c->nqueued[SCHED_FAIR] > 0 && ticknow() - c->fairlast >= FAIRSTARVE;
+}
+
+// Should p, running on c, give way to a process waiting there,
+// or, if p is SCHED_FAIR, to one with less vruntime anywhere?
+static int
+needresched(struct cpu *c, struct proc *p)
+{
+  struct proc *w;
+  uint64 vr;
+  int k, r;
+
+  r = 0;
+  acquire(&c->rqlock);
+  if(p->sclass != SCHED_FAIR && fairstarved(c))
+    r = 1;
+  for(k = 0; k < NSCHED && !r; k++)
+    if(c->nqueued[k] > 0 && (w = schedclass[k].peek(c)) != 0)
+      r = runsbefore(w, p);
+  release(&c->rqlock);
+  if(!r && p->sclass == SCHED_FAIR && fairbest(&vr) != 0 && vr < p->vruntime)
+    r = 1;
+  return r;
+}
+
+// Charge p for the time it has run since p->lastrun.
+// Caller must hold p->lock.
+static void
+charge(struct proc *p)
+{
+  uint64 now, t;
+
+  now = r_time();
+  t = now - p->lastrun;
+  p->lastrun = now;
+  p->runtime += t;
+  if(p->sclass == SCHED_FAIR)
+    p->vruntime += t * SCHED_WEIGHT / p->weight;
+}
+
+// Make p RUNNABLE and put it on a run queue.
+// Caller must hold p->lock.
+static void
+runqput(struct proc *p)
+{
+  struct cpu *c = &cpus[p->cpu], *oc;
+  struct proc *q;
+
+  // charge it now, while its vruntime may still change.
+  if(p->state == RUNNING)
+    charge(p);
+  p->state = RUNNABLE;
+  acquire(&c->rqlock);
+  schedclass[p->sclass].enqueue(c, p);
+  c->nqueued[p->sclass]++;
+  c->nrunnable++;
+  release(&c->rqlock);
+
+  // wake c if it is idle, or else another idle CPU to take
+  // the work from it. pairs with the check in idle().
+  __sync_synchronize();
+  if(c->idle){
+    ipiwake(c - cpus);
+    return;
+  }
+  for(oc = cpus; oc < &cpus[NCPU]; oc++){
+    if(oc->idle){
+      ipiwake(oc - cpus);
+      return;
+    }
+  }
+
+  // if p should run before what c is running, tell c now
+  // rather than at its next tick. a racy look at c->proc,
+  // which costs at worst a needless interrupt or a tick's wait;
+  // should q be reaped meanwhile, its page stays mapped, if
+  // not as a proc.
+  if(c != mycpu() && (q = c->proc) != 0 && runsbefore(p, q))
+    ipiresched(c - cpus);
+}
+
+// Take a process of class k off c's run queues, or return 0.
+// Caller must hold c->rqlock.
+static struct proc*
+runqtake(struct cpu *c, int k)
+{
+  struct proc *p;
+
+  // p->sclass may have changed since p was queued;
+  // count it against the queue it was on.
+  if(c->nqueued[k] > 0 && (p = schedclass[k].dequeue(c)) != 0){
+    c->nqueued[k]--;
+    c->nrunnable--;
+    return p;
+  }
+  return 0;
+}
+
+// Take the next process to run off c's run queues, or
+// return 0: a starved SCHED_FAIR one, or else one of the
+// classes before SCHED_FAIR. fairget() looks after the rest.
+static struct proc*
+runqget(struct cpu *c)
+{
+  struct proc *p;
+  int k;
+
+  // an unlocked peek, so that CPUs looking for work
+  // leave the lock alone while c has none.
+  if(__atomic_load_n(&c->nrunnable, __ATOMIC_RELAXED) == 0)
+    return 0;
+  acquire(&c->rqlock);
+  p = 0;
+  if(fairstarved(c))
+    p = runqtake(c, SCHED_FAIR);
+  for(k = 0; k < SCHED_FAIR && p == 0; k++)
+    p = runqtake(c, k);
+  release(&c->rqlock);
+  return p;
+}
+
+// Take the SCHED_FAIR process with the least vruntime off
+// whichever CPU's queue it is on, or return 0.
+static struct proc*
+fairget(void)
+{
+  struct cpu *oc;
+  struct proc *p;
+  uint64 vr;
+
+  while((oc = fairbest(&vr)) != 0){
+    acquire(&oc->rqlock);
+    p = runqtake(oc, SCHED_FAIR);
+    release(&oc->rqlock);
+    if(p)
+      return p;
+    // another CPU took it first.
+  }
+  return 0;
+}
+
+// Halt this CPU until an interrupt, unless there is work to
+// do; runqput() wakes an idle CPU when it queues work.
+static void
+idle(struct cpu *c)
+{
+  uint64 t0;
+  int i;
+
+  // with interrupts off, a kick that comes after the check
+  // stays pending and wfi returns at once.
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++)
+    if(cpus[i].nrunnable > 0)
+      break;
+  if(i == NCPU){
+    timeridle();
+    t0 = r_time();
+    asm volatile("wfi");
+    c->idletime += r_time() - t0;
+    c->wakeups++;
+  }
+  c->idle = 0;
+  intr_on();
+}
+
+// Report the time each CPU that has started has spent idle
+// in st[0..n-1]. Returns the number of CPUs started.
+int
+cpustat(struct cpustats *st, int n)
+{
+  struct cpu *c;
+  int ncpu;
+
+  ncpu = 0;
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->start == 0)
+      continue;
+    if(ncpu < n){
+      st[ncpu].time = r_time() - c->start;
+      st[ncpu].idle = c->idletime;
+      st[ncpu].wakeups = c->wakeups;
+    }
+    ncpu++;
+  }
+  return ncpu;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process off this CPU's run queue, or, if
+//    it is empty, off another CPU's, or, if there is
+//    none, halt until there might be.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -447,30 +1215,47 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id, i;
 
+  id = cpuid();
   c->proc = 0;
+  c->start = r_time();
   for(;;){
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
     // processes are waiting.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    p = runqget(c);
+    if(p == 0)
+      p = fairget();
+    for(i = 1; p == 0 && i < NCPU; i++)
+      p = runqget(&cpus[(id + i) % NCPU]);
+    if(p == 0){
+      idle(c);
+      continue;
     }
+
+    // The process that put p on the queue may still hold
+    // p->lock, on its way into sched(); wait for it.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    p->lastrun = r_time();
+    c->proc = p;
+    timerstart();
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -496,6 +1281,8 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
+  if(p->state != RUNNABLE)
+    charge(p);  // else runqput() did
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
@@ -507,11 +1294,124 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runqput(p);
   sched();
   release(&p->lock);
 }
 
+// Called on a timer interrupt, in the process it interrupted.
+// Charge the process for its time, and give up the CPU if its
+// time is up or a process that should run before it is waiting.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  charge(p);
+  if(schedclass[p->sclass].tick(p) || needresched(mycpu(), p)){
+    runqput(p);
+    sched();
+  }
+  release(&p->lock);
+}
+
+// Called when another CPU has asked this one to reschedule,
+// in the process it interrupted. Give up the CPU if a process
+// that should run before it is waiting.
+void
+resched(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  charge(p);
+  if(needresched(mycpu(), p)){
+    runqput(p);
+    sched();
+  }
+  release(&p->lock);
+}
+
+// Find the process with the given pid, or the caller if pid
+// is 0, and return it with p->lock held; or return 0.
+static struct proc*
+findproc(int pid)
+{
+  if(pid == 0)
+    pid = myproc()->pid;
+  return pidlookup(pid);
+}
+
+// Set the highest level at which the process with the given
+// pid, or the caller if pid is 0, may run to prio, moving it
+// down to it at once. A negative prio leaves it alone.
+// Returns the old setting, or -1 if there is no such process.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+  int old;
+
+  if(prio >= NPRIO || (p = findproc(pid)) == 0)
+    return -1;
+  old = p->prio;
+  if(prio >= 0){
+    p->prio = prio;
+    if(p->level < prio)
+      p->level = prio;
+  }
+  release(&p->lock);
+  return old;
+}
+
+// Set the scheduling class and weight of the process with the
+// given pid, or the caller if pid is 0. A negative class or a
+// weight of 0 leaves that alone. A RUNNABLE process moves to
+// its new class the next time it is queued.
+// Returns 0, or -1 if there is no such process.
+int
+setsched(int pid, int class, int weight)
+{
+  struct proc *p;
+
+  if(class >= NSCHED || weight < 0 || weight > SCHED_MAXWEIGHT)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  // charge a running p at the old rate.
+  if(p->state == RUNNING)
+    charge(p);
+  if(class >= 0 && class != p->sclass){
+    p->sclass = class;
+    p->vruntime = 0;  // to start at fairmin.
+  }
+  if(weight > 0)
+    p->weight = weight;
+  release(&p->lock);
+  return 0;
+}
+
+// Report the scheduling state of the process with the given
+// pid, or the caller if pid is 0, in *si.
+// Returns 0, or -1 if there is no such process.
+int
+getsched(int pid, struct schedinfo *si)
+{
+  struct proc *p;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  if(p->state == RUNNING)
+    charge(p);
+  si->class = p->sclass;
+  si->weight = p->weight;
+  si->prio = p->prio;
+  si->runtime = p->runtime;
+  release(&p->lock);
+  return 0;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -536,6 +1436,44 @@ forkret(void)
   usertrapret();
 }
 
+static struct sleepq*
+sqhash(void *chan)
+{
+  return &sleepq[(uint64)chan % NSLEEPQ];
+}
+
+// Put p on the wait queue for p->chan.
+// Caller must hold p->lock.
+static void
+sqput(struct proc *p)
+{
+  struct sleepq *sq = sqhash(p->chan);
+
+  acquire(&sq->lock);
+  p->sqnext = sq->head;
+  sq->head = p;
+  p->onsq = 1;
+  release(&sq->lock);
+}
+
+// Take p off its wait queue, if a wakeup() has not already.
+// Caller must hold p->lock.
+static void
+sqremove(struct proc *p)
+{
+  struct sleepq *sq = sqhash(p->chan);
+  struct proc **pp;
+
+  acquire(&sq->lock);
+  if(p->onsq){
+    for(pp = &sq->head; *pp != p; pp = &(*pp)->sqnext)
+      ;
+    *pp = p->sqnext;
+    p->onsq = 0;
+  }
+  release(&sq->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -545,16 +1483,18 @@ sleep(void *chan, struct spinlock *lk)
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once p is on chan's wait queue, and we
+  // hold p->lock, we can be guaranteed that
+  // we won't miss any wakeup (wakeup finds
+  // p on the queue, then locks p->lock),
   // so it's okay to release lk.
 
   acquire(&p->lock);  //DOC: sleeplock1
+  p->chan = chan;
+  sqput(p);
   release(lk);
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
 
   sched();
@@ -572,17 +1512,40 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *sq = sqhash(chan);
+  struct proc *p, **pp, *woken[8];
+  int i, n;
+
+  do {
+    // take a few of chan's sleepers off the queue, then
+    // wake them after releasing sq->lock, which comes
+    // after p->lock.
+    n = 0;
+    acquire(&sq->lock);
+    for(pp = &sq->head; *pp && n < NELEM(woken); ){
+      p = *pp;
+      if(p->chan == chan){
+        *pp = p->sqnext;
+        p->onsq = 0;
+        woken[n++] = p;
+      } else {
+        pp = &p->sqnext;
+      }
+    }
+    release(&sq->lock);
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+    for(i = 0; i < n; i++){
+      p = woken[i];
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        // kill() may have woken p, and p gone back
+        // to sleep, on the queue again.
+        sqremove(p);
+        runqput(p);
       }
       release(&p->lock);
     }
-  }
+  } while(n == NELEM(woken));
 }
 
 // Kill the process with the given pid.
@@ -593,20 +1556,21 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if((p = pidlookup(pid)) == 0)
+    return -1;
+  if(p->kthread){
+    // it would not notice.
     release(&p->lock);
+    return -1;
   }
-  return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    sqremove(p);
+    runqput(p);
+  }
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -672,18 +1636,26 @@ procdump(void)
   [RUNNING]   "run   ",
   [ZOMBIE]    "zombie"
   };
-  struct proc *p;
+  struct slab *s;
+  struct proc *p, *page;
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state == UNUSED)
+  for(s = slab; s < &slab[NSLAB]; s++){
+    if((page = s->procs) == 0)
       continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+    for(p = page; p < &page[slabsize(s)]; p++){
+      if(p->state == UNUSED)
+        continue;
+      if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+        state = states[p->state];
+      else
+        state = "???";
+      if(p->kthread)
+        printf("%d %s [%s]", p->pid, state, p->name);
+      else
+        printf("%d %s %s", p->pid, state, p->name);
+      printf("\n");
+    }
   }
 }
@@ -24,6 +24,19 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct spinlock rqlock;     // Protects the run queues
+  int nrunnable;              // Length of the run queues together
+  int nqueued[NSCHED];        // Length of each class's run queues
+  struct proc *rqhead[NPRIO]; // SCHED_MLFQ run queues, by level
+  struct proc *rqtail[NPRIO];
+  uint boost;                 // Last priority boost of the run queues
+  struct proc *fairq;         // SCHED_FAIR run queue, by vruntime
+  uint fairlast;              // Tick fairq was last served, or filled
+  int idle;                   // Halted, waiting for work?
+  uint64 start;               // When scheduler() started, in cycles
+  uint64 idletime;            // Cycles spent halted
+  uint64 wakeups;             // Times woken from halt
+  uint64 nexttick;            // When the running process's tick is up
 };
 
 extern struct cpu cpus[NCPU];
@@ -91,11 +104,42 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU it last ran on
+  int prio;                    // Highest level it may run at (setpriority())
+  int level;                   // Scheduling level; 0 runs first
+  int used;                    // Ticks used at this level
+  uint boost;                  // Last priority boost it has had
+  int sclass;                  // Scheduling class (SCHED_*)
+  int weight;                  // Share of the CPU under SCHED_FAIR
+  uint64 vruntime;             // Time run divided by weight, for SCHED_FAIR
+  uint64 runtime;              // Time run, in units of the cycle counter
+  uint64 lastrun;              // When runtime was last brought up to date
 
-  // wait_lock must be held when using this:
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next on a run queue
+
+  // the wait queue's lock must be held when using these:
+  int onsq;                    // On chan's wait queue?
+  struct proc *sqnext;         // Next on the wait queue
+
+  // the timer queue's lock must be held when using these:
+  uint64 wakeat;               // When to wake from timersleep()
+  int theap;                   // Index in the timer queue's heap, or -1
+
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of the same parent
+
+  // the slab's and pid hash's locks must be held when using these:
+  struct proc *freenext;       // Next UNUSED proc on its slab page
+  struct proc *pidnext;        // Next in pid's hash chain
 
   // these are private to the process, so p->lock need not be held.
+  struct slab *slab;           // Slab page it is on; set with the page
+  int kthread;                 // Kernel thread, with no user memory?
+  void (*kfn)(void*);          // Kernel thread's function
+  void *karg;                  // ... and its argument
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
@@ -103,5 +147,6 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  int fsop;                    // Inside begin_op()/end_op()
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,15 @@
+// Scheduling classes, for setsched(). A CPU runs a process of a
+// later class only when none of an earlier class is waiting.
+#define SCHED_MLFQ    0  // priority levels (setpriority()), round-robin in each
+#define SCHED_FAIR    1  // a share of the CPU in proportion to weight
+
+#define SCHED_WEIGHT    100  // weight of a new process
+#define SCHED_MAXWEIGHT 10000
+
+// What getsched() reports about a process.
+struct schedinfo {
+  int class;        // SCHED_MLFQ or SCHED_FAIR
+  int weight;       // share under SCHED_FAIR
+  int prio;         // highest level under SCHED_MLFQ
+  uint64 runtime;   // time it has run, in units of the cycle counter
+};
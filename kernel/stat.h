@@ -9,3 +9,20 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// In-memory inode table statistics, from istats().
+struct istats {
+  uint64 gets;      // inode lookups
+  uint64 hits;      // ... that found the inode in memory
+  uint64 evictions; // unused inodes dropped to make room
+  uint ninode;      // inodes in memory
+  uint nactive;     // ... in use
+  uint ncached;     // ... unused, kept in case they are wanted again
+};
+
+// Time a CPU has spent idle, from cpustats().
+struct cpustats {
+  uint64 time;      // cycles since it started scheduling
+  uint64 idle;      // ... spent halted with nothing to run
+  uint64 wakeups;   // times it was woken from halt
+};
@@ -101,6 +101,26 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_fmap(void);
+extern uint64 sys_istats(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_fstatat(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_logasync(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_setsched(void);
+extern uint64 sys_getsched(void);
+extern uint64 sys_cpustats(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_nanouptime(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +146,26 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_fmap]    sys_fmap,
+[SYS_istats]  sys_istats,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_getdents] sys_getdents,
+[SYS_fstatat] sys_fstatat,
+[SYS_sendfile] sys_sendfile,
+[SYS_splice] sys_splice,
+[SYS_fsync]  sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_logasync] sys_logasync,
+[SYS_fallocate] sys_fallocate,
+[SYS_setpriority] sys_setpriority,
+[SYS_setsched] sys_setsched,
+[SYS_getsched] sys_getsched,
+[SYS_cpustats] sys_cpustats,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_nanouptime] sys_nanouptime,
 };
 
 void
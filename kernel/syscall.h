@@ -20,3 +20,23 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_fmap   22
+#define SYS_istats 23
+#define SYS_pread  24
+#define SYS_pwrite 25
+#define SYS_readv  26
+#define SYS_writev 27
+#define SYS_getdents 28
+#define SYS_fstatat 29
+#define SYS_sendfile 30
+#define SYS_splice 31
+#define SYS_fsync  32
+#define SYS_fdatasync 33
+#define SYS_logasync 34
+#define SYS_fallocate 35
+#define SYS_setpriority 36
+#define SYS_setsched 37
+#define SYS_getsched 38
+#define SYS_cpustats 39
+#define SYS_nanosleep 40
+#define SYS_nanouptime 41
@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -94,6 +95,184 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Fetch the iovec array for readv() or writev() into iov.
+// The lengths must add up to at most IOV_MAXLEN, so that each
+// one, and the total returned, fits in an int.
+static int
+argiov(struct iovec *iov, int *n)
+{
+  uint64 uiov, tot;
+  int i;
+
+  argaddr(1, &uiov);
+  argint(2, n);
+  if(*n < 0 || *n > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, *n * sizeof(struct iovec)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < *n; i++){
+    if(iov[i].iov_len > IOV_MAXLEN - tot)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &n) < 0)
+    return -1;
+  return filereadv(f, iov, n);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &n) < 0)
+    return -1;
+  return filewritev(f, iov, n);
+}
+
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  int n;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || n < 0)
+    return -1;
+  return filegetdents(f, p, n);
+}
+
+// Copy up to n bytes of file in_fd to out_fd within the kernel.
+// in_fd is read at offset off, leaving its own offset alone,
+// or, if off is negative, at and advancing its own offset.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+  uint uoff;
+
+  argint(2, &off);
+  argint(3, &n);
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || n < 0)
+    return -1;
+  if(in->type != FD_INODE)
+    return -1;
+  if(off < 0)
+    return filesend(out, in, 0, n);
+  uoff = off;
+  return filesend(out, in, &uoff, n);
+}
+
+// Move up to n bytes from in_fd to out_fd within the kernel,
+// at their own offsets. One of them must be a pipe.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || n < 0)
+    return -1;
+  if(in->type != FD_PIPE && out->type != FD_PIPE)
+    return -1;
+  return filesend(out, in, 0, n);
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f, 0);
+}
+
+uint64
+sys_fdatasync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f, 1);
+}
+
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int mode, off, len;
+
+  argint(1, &mode);
+  argint(2, &off);
+  argint(3, &len);
+  if(argfd(0, 0, &f) < 0 || off < 0 || len < 0)
+    return -1;
+  return filefallocate(f, mode, off, len);
+}
+
+// Turn asynchronous commit of the file system log on or off,
+// or, if the argument is negative, leave it be; return the old
+// setting. While it is on, a system call that changes the file
+// system returns before its changes are on disk, and they get
+// there when the log fills up or at the next fsync().
+uint64
+sys_logasync(void)
+{
+  int on;
+
+  argint(0, &on);
+  return log_async(on < 0 ? -1 : on != 0);
+}
+
 uint64
 sys_close(void)
 {
@@ -119,6 +298,41 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Get metadata about path, looked up relative to the directory
+// open as fd, or to the current directory if fd is AT_FDCWD,
+// without opening it.
+uint64
+sys_fstatat(void)
+{
+  char path[MAXPATH];
+  struct file *f;
+  struct inode *dp, *ip;
+  struct stat st;
+  uint64 addr; // user pointer to struct stat
+  int fd;
+
+  argint(0, &fd);
+  argaddr(2, &addr);
+  if(argstr(1, path, MAXPATH) < 0)
+    return -1;
+  dp = 0;
+  if(fd != AT_FDCWD){
+    if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+      return -1;
+    dp = f->ip;
+  }
+
+  if((ip = nameiat(dp, path)) == 0)
+    return -1;
+  ilock(ip);
+  stati(ip, &st);
+  iunlockput(ip);
+
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -149,7 +363,7 @@ sys_link(void)
   if((dp = nameiparent(new, name)) == 0)
     goto bad;
   ilock(dp);
-  if(dp->dev != ip->dev || dirlink(dp, name, ip->inum) < 0){
+  if(dp->dev != ip->dev || dp->nlink < 1 || dirlink(dp, name, ip->inum) < 0){
     iunlockput(dp);
     goto bad;
   }
@@ -189,7 +403,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -219,9 +432,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -262,7 +473,14 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0){
+  if(dp->nlink < 1){
+    // dp has been removed: nothing could find a new entry in
+    // it, and freeing dp would lose the entry's inode.
+    iunlockput(dp);
+    return 0;
+  }
+
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0){
     iunlockput(dp);
     return 0;
   }
@@ -305,7 +523,7 @@ uint64
 sys_open(void)
 {
   char path[MAXPATH];
-  int fd, omode;
+  int fd, omode, logged;
   struct file *f;
   struct inode *ip;
   int n;
@@ -314,30 +532,38 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
-  begin_op();
+  // only creating or truncating the file writes to the disk;
+  // a plain lookup can stay out of the log.
+  logged = omode & (O_CREATE | O_TRUNC);
+  if(logged)
+    begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
-      end_op();
+      if(logged)
+        end_op();
       return -1;
     }
   } else {
     if((ip = namei(path)) == 0){
-      end_op();
+      if(logged)
+        end_op();
       return -1;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
-      end_op();
+      if(logged)
+        end_op();
       return -1;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
-    end_op();
+    if(logged)
+      end_op();
     return -1;
   }
 
@@ -345,7 +571,8 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
-    end_op();
+    if(logged)
+      end_op();
     return -1;
   }
 
@@ -359,13 +586,15 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->direct = (omode & O_DIRECT) && ip->type == T_FILE;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
 
   iunlock(ip);
-  end_op();
+  if(logged)
+    end_op();
 
   return fd;
 }
@@ -413,20 +642,15 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
-    end_op();
+  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0)
     return -1;
-  }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
-    end_op();
     return -1;
   }
   iunlock(ip);
   iput(p->cwd);
-  end_op();
   p->cwd = ip;
   return 0;
 }
@@ -503,3 +727,44 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Copy up to n of the extents that map the file open on fd
+// to the user array ext, and return how many the file has.
+uint64
+sys_fmap(void)
+{
+  struct file *f;
+  struct inode *ip;
+  uint64 ext;
+  int n, next;
+
+  argaddr(1, &ext);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  ip = f->ip;
+  ilock(ip);
+  next = ip->next;
+  if(n > next)
+    n = next;
+  if(copyout(myproc()->pagetable, ext, (char*)ip->ext, n*sizeof(struct extent)) < 0){
+    iunlock(ip);
+    return -1;
+  }
+  iunlock(ip);
+  return next;
+}
+
+// Copy the inode table's statistics to the user struct istats.
+uint64
+sys_istats(void)
+{
+  struct istats st;
+  uint64 addr;
+
+  argaddr(0, &addr);
+  istat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
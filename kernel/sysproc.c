@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sched.h"
+#include "stat.h"
 
 uint64
 sys_exit(void)
@@ -52,22 +54,20 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return ticksleep(n);
+}
+
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  argaddr(0, &ns);
+  return nanosleep(ns);
 }
 
 uint64
@@ -79,15 +79,82 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+// set the scheduling priority of a process;
+// return the old one.
+uint64
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  argint(0, &pid);
+  argint(1, &prio);
+  return setpriority(pid, prio);
+}
+
+// set the scheduling class and weight of a process.
+uint64
+sys_setsched(void)
+{
+  int pid, class, weight;
+
+  argint(0, &pid);
+  argint(1, &class);
+  argint(2, &weight);
+  return setsched(pid, class, weight);
+}
+
+// report the scheduling state of a process.
+uint64
+sys_getsched(void)
+{
+  int pid;
+  uint64 addr;
+  struct schedinfo si;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if(getsched(pid, &si) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char *)&si, sizeof(si)) < 0)
+    return -1;
+  return 0;
+}
+
+// report how much each CPU has been idle, for up to n CPUs;
+// return the number of CPUs.
+uint64
+sys_cpustats(void)
+{
+  int n, ncpu;
+  uint64 addr;
+  struct cpustats st[NCPU];
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  if(n > NCPU)
+    n = NCPU;
+  ncpu = cpustat(st, n);
+  if(ncpu < n)
+    n = ncpu;
+  if(copyout(myproc()->pagetable, addr, (char *)st, n*sizeof(st[0])) < 0)
+    return -1;
+  return ncpu;
+}
+
+// return how many clock ticks have passed
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return ticknow();
+}
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+// return how many nanoseconds have passed
+// since start.
+uint64
+sys_nanouptime(void)
+{
+  return nanouptime();
 }
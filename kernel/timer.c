@@ -0,0 +1,223 @@
+//
+// Timers.
+//
+// There is no periodic clock interrupt. Each CPU programs its
+// CLINT mtimecmp for the next thing it has to do: the next
+// scheduling tick of the process it is running, if any, or
+// the earliest wakeup in its timer queue. An idle CPU with no
+// timers pending is not interrupted at all.
+//
+// A process that sleeps for a time goes on the timer queue of
+// the CPU it sleeps on, a heap ordered by wakeup time, and
+// that CPU wakes it when the time comes.
+//
+// ticks, as seen by sleep() and uptime(), are TICKCYCLES of
+// the CLINT's clock, counted from boot.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define TICKCYCLES (CLINT_HZ / 10)  // a tick; about 1/10th second
+#define NEVER (~(uint64)0)
+
+struct timerq {
+  struct spinlock lock;
+  uint64 first;                 // earliest wakeup, or NEVER
+  int n;                        // processes in heap
+  struct proc *heap[NPROC];     // by p->wakeat
+} timerq[NCPU];
+
+void
+timerqinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    initlock(&timerq[i].lock, "timerq");
+    timerq[i].first = NEVER;
+  }
+}
+
+// Ticks since boot.
+uint
+ticknow(void)
+{
+  return r_time() / TICKCYCLES;
+}
+
+// Program this CPU's timer for its next tick, if it is
+// running a process, or its next wakeup, whichever is first.
+// Interrupts must be off.
+static void
+settimer(struct cpu *c, struct timerq *tq)
+{
+  uint64 when;
+
+  when = c->proc ? c->nexttick : NEVER;
+  if(tq->first < when)
+    when = tq->first;
+  *(volatile uint64*)CLINT_MTIMECMP(c - cpus) = when;
+}
+
+static void
+heapswap(struct timerq *tq, int i, int j)
+{
+  struct proc *p = tq->heap[i];
+
+  tq->heap[i] = tq->heap[j];
+  tq->heap[j] = p;
+  tq->heap[i]->theap = i;
+  tq->heap[j]->theap = j;
+}
+
+// Restore the heap order around heap[i].
+static void
+heapfix(struct timerq *tq, int i)
+{
+  int c;
+
+  while(i > 0 && tq->heap[i]->wakeat < tq->heap[(i-1)/2]->wakeat){
+    heapswap(tq, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+  for(;;){
+    c = 2*i + 1;
+    if(c >= tq->n)
+      break;
+    if(c+1 < tq->n && tq->heap[c+1]->wakeat < tq->heap[c]->wakeat)
+      c++;
+    if(tq->heap[i]->wakeat <= tq->heap[c]->wakeat)
+      break;
+    heapswap(tq, i, c);
+    i = c;
+  }
+}
+
+// Take p off tq. Caller must hold tq->lock.
+static void
+heapremove(struct timerq *tq, struct proc *p)
+{
+  int i = p->theap;
+
+  p->theap = -1;
+  if(--tq->n != i){
+    tq->heap[i] = tq->heap[tq->n];
+    tq->heap[i]->theap = i;
+    heapfix(tq, i);
+  }
+  tq->first = tq->n > 0 ? tq->heap[0]->wakeat : NEVER;
+}
+
+// Called by scheduler() as it switches to a process:
+// give the process a tick before it is interrupted.
+void
+timerstart(void)
+{
+  struct cpu *c = mycpu();
+
+  c->nexttick = r_time() + TICKCYCLES;
+  settimer(c, &timerq[cpuid()]);
+}
+
+// Called by idle() before it halts: wait only for wakeups.
+void
+timeridle(void)
+{
+  settimer(mycpu(), &timerq[cpuid()]);
+}
+
+// The timer has gone off: wake the processes whose time has
+// come. Returns 1 if the running process's tick is up.
+int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  struct timerq *tq = &timerq[cpuid()];
+  struct proc *p;
+  uint64 now;
+  int tick;
+
+  now = r_time();
+  acquire(&tq->lock);
+  while(tq->n > 0 && (p = tq->heap[0])->wakeat <= now){
+    heapremove(tq, p);
+    wakeup(&p->wakeat);
+  }
+  tick = 0;
+  if(c->proc && now >= c->nexttick){
+    c->nexttick = now + TICKCYCLES;
+    tick = 1;
+  }
+  settimer(c, tq);
+  release(&tq->lock);
+  return tick;
+}
+
+// Sleep until the CLINT's clock reaches when.
+// Returns -1 if killed first.
+int
+timersleep(uint64 when)
+{
+  struct proc *p = myproc();
+  struct timerq *tq;
+  int r;
+
+  // the timer queue of the CPU we are on; holding its
+  // lock keeps us on that CPU until sleep().
+  push_off();
+  tq = &timerq[cpuid()];
+  acquire(&tq->lock);
+  pop_off();
+
+  if(tq->n == NPROC)
+    panic("timersleep");
+  p->wakeat = when;
+  p->theap = tq->n;
+  tq->heap[tq->n++] = p;
+  heapfix(tq, p->theap);
+  if(tq->first != tq->heap[0]->wakeat){
+    tq->first = tq->heap[0]->wakeat;
+    settimer(mycpu(), tq);
+  }
+
+  r = 0;
+  while(r_time() < when){
+    if(killed(p)){
+      r = -1;
+      break;
+    }
+    sleep(&p->wakeat, &tq->lock);
+  }
+  if(p->theap >= 0)
+    heapremove(tq, p);
+  release(&tq->lock);
+  return r;
+}
+
+// Sleep for n ticks, counted from the start of the
+// current one. Returns -1 if killed first.
+int
+ticksleep(int n)
+{
+  return timersleep((uint64)(ticknow() + n) * TICKCYCLES);
+}
+
+// Sleep for ns nanoseconds. Returns -1 if killed first.
+int
+nanosleep(uint64 ns)
+{
+  return timersleep(r_time() + (ns + NSPERCYCLE - 1) / NSPERCYCLE);
+}
+
+// Nanoseconds since boot.
+uint64
+nanouptime(void)
+{
+  return r_time() * NSPERCYCLE;
+}
@@ -0,0 +1,8 @@
+// A buffer for readv() and writev().
+struct iovec {
+  void *iov_base;   // start
+  uint64 iov_len;   // length in bytes
+};
+
+#define IOV_MAX 16  // max buffers per readv() or writev()
+#define IOV_MAXLEN 0x7fffffff  // max bytes, so counts fit in an int
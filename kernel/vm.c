@@ -20,6 +20,7 @@ pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
+  uint64 va;
 
   kpgtbl = (pagetable_t) kalloc();
   memset(kpgtbl, 0, PGSIZE);
@@ -34,6 +35,9 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, to interrupt other CPUs
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -44,8 +48,13 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
+  // kernel stacks are mapped and unmapped as the process
+  // slab grows and shrinks; see kvmstack(). Their page-table
+  // pages are allocated now, so that the stacks are the only
+  // memory that mapping them takes.
+  for(va = KSTACK(NPROC-1); va < TRAMPOLINE; va += PGSIZE)
+    if(walk(kpgtbl, va, 1) == 0)
+      panic("kvmmake");
 
   return kpgtbl;
 }
@@ -131,6 +140,24 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// Look up a user virtual address for direct I/O, and return the
+// physical address it maps to, or 0 if it is not a user address
+// or, if write is set, not a writable one.
+uint64
+useraddr(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  if(write && (*pte & PTE_W) == 0)
+    return 0;
+  return PTE2PA(*pte) + (va - PGROUNDDOWN(va));
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
@@ -141,6 +168,38 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
     panic("kvmmap");
 }
 
+// Allocate a kernel stack page and map it at va in the kernel
+// page table, for a new proc. Callers serialise, and flush
+// the TLBs. Returns 0 on success, -1 if out of memory.
+int
+kvmstack(uint64 va)
+{
+  char *pa;
+
+  if((pa = kalloc()) == 0)
+    return -1;
+  if(mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    kfree(pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Unmap the kernel stack at va and return its page, for the
+// caller to free once it has flushed the TLBs.
+void*
+kvmunstack(uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if((pte = walk(kernel_pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+    panic("kvmunstack");
+  pa = PTE2PA(*pte);
+  *pte = 0;
+  return (void*)pa;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
@@ -15,16 +15,17 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
-
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | group 0 | group 1 | ... ]
+// where each group is
+// [ free bit map block | inode blocks | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int ngroups;  // Number of block groups
+int ipg;      // Inodes per group
+int nmeta;    // Number of meta blocks (boot, sb, nlog, bitmap, inode)
 int nblocks;  // Number of data blocks
+uint fssize = FSSIZE;
 
 int fsfd;
 struct superblock sb;
@@ -33,7 +34,8 @@ uint freeinode = 1;
 uint freeblock;
 
 
-void balloc(int);
+void balloc(void);
+uint nextblock(void);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
@@ -90,24 +92,35 @@ main(int argc, char *argv[])
     die(argv[1]);
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  // Split the blocks after the log into groups of BPG, and
+  // spread the inodes evenly over them. A last group too
+  // small to hold its own metadata and some data is dropped.
+  ngroups = (FSSIZE - (2+nlog) + BPG - 1) / BPG;
+  ipg = ((NINODES + ngroups - 1) / ngroups + IPB - 1) / IPB * IPB;
+  if(FSSIZE - (2+nlog) - (ngroups-1)*BPG < 1 + ipg/IPB + 1){
+    ngroups--;
+    fssize = 2 + nlog + ngroups*BPG;
+  }
+  nmeta = 2 + nlog + ngroups*(1 + ipg/IPB);
+  nblocks = fssize - nmeta;
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.version = xint(FSVERSION);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ngroups*ipg);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.groupstart = xint(2+nlog);
+  sb.ngroups = xint(ngroups);
+  sb.ipg = xint(ipg);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u, %d groups of 1 bitmap block and %u inode blocks) blocks %d total %d\n",
+         nmeta, nlog, ngroups, (uint)(ipg/IPB), nblocks, fssize);
 
-  freeblock = nmeta;     // the first free block that we can allocate
+  freeblock = GDATA(0, sb);     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < fssize; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -167,7 +180,7 @@ main(int argc, char *argv[])
   din.size = xint(off);
   winode(rootino, &din);
 
-  balloc(freeblock);
+  balloc();
 
   exit(0);
 }
@@ -227,27 +240,94 @@ ialloc(ushort type)
   din.type = xshort(type);
   din.nlink = xshort(1);
   din.size = xint(0);
+  if(type == T_FILE)
+    din.flags = xint(DI_INLINE);
   winode(inum, &din);
   return inum;
 }
 
+// Return the next unused data block, skipping over the
+// metadata at the start of each group.
+uint
+nextblock(void)
+{
+  uint g;
+
+  g = BGROUP(freeblock, sb);
+  if(freeblock < GDATA(g, sb))
+    freeblock = GDATA(g, sb);
+  if(freeblock >= fssize)
+    die("out of blocks");
+  return freeblock++;
+}
+
+// Write each group's bitmap: the group's own metadata, the
+// data blocks below freeblock, and any bits past the end of
+// the disk are in use.
 void
-balloc(int used)
+balloc(void)
 {
   uchar buf[BSIZE];
+  uint g, b;
+
+  printf("balloc: first %d blocks have been allocated\n", freeblock);
+  for(g = 0; g < ngroups; g++){
+    bzero(buf, BSIZE);
+    for(b = GSTART(g, sb); b < GSTART(g+1, sb); b++){
+      if(b < GDATA(g, sb) || b < freeblock || b >= fssize)
+        buf[BBIT(b, sb)/8] |= 0x1 << (BBIT(b, sb)%8);
+    }
+    wsect(GSTART(g, sb), buf);
+  }
+}
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// Read the extent list of din into ext[], in host byte order.
+// Returns the number of extents.
+int
+rextents(struct dinode *din, struct extent *ext)
+{
+  struct extent blk[NINDEXTENT];
   int i;
 
-  printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  memset(ext, 0, MAXEXTENT*sizeof(struct extent));
+  memmove(ext, din->ext, sizeof(din->ext));
+  if(xint(din->extblock) != 0){
+    rsect(xint(din->extblock), (char*)blk);
+    memmove(ext + NEXTENT, blk, sizeof(blk));
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  for(i = 0; i < MAXEXTENT && ext[i].len != 0; i++){
+    ext[i].lbn = xint(ext[i].lbn);
+    ext[i].bn = xint(ext[i].bn);
+    ext[i].len = xint(ext[i].len);
+  }
+  return i;
 }
 
-#define min(a, b) ((a) < (b) ? (a) : (b))
+// Write the n extents in ext[] back to din and its extent block.
+void
+wextents(struct dinode *din, struct extent *ext, int n)
+{
+  struct extent x[MAXEXTENT];
+  char buf[BSIZE];
+  int i;
+
+  memset(x, 0, sizeof(x));
+  for(i = 0; i < n; i++){
+    x[i].lbn = xint(ext[i].lbn);
+    x[i].bn = xint(ext[i].bn);
+    x[i].len = xint(ext[i].len);
+  }
+  memmove(din->ext, x, sizeof(din->ext));
+  if(n > NEXTENT){
+    if(xint(din->extblock) == 0)
+      din->extblock = xint(nextblock());
+    memset(buf, 0, sizeof(buf));
+    memmove(buf, x + NEXTENT, NINDEXTENT*sizeof(struct extent));
+    wsect(xint(din->extblock), buf);
+  }
+}
 
 void
 iappend(uint inum, void *xp, int n)
@@ -256,30 +336,51 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
+  struct extent ext[MAXEXTENT], *e;
+  int next;
   uint x;
 
   rinode(inum, &din);
   off = xint(din.size);
+  if(xint(din.flags) & DI_INLINE){
+    if(off + n <= NINLINE){
+      bcopy(p, din.data + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // too big to stay inline: move what there is out to a block.
+    bcopy(din.data, buf, off);
+    memset(din.data, 0, NINLINE);
+    din.flags = 0;
+    din.size = 0;
+    winode(inum, &din);
+    if(off > 0)
+      iappend(inum, buf, off);
+    rinode(inum, &din);
+  }
+  next = rextents(&din, ext);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
+    // blocks are only ever appended, so fbn is either mapped
+    // by the last extent or is the next block after it.
+    e = next > 0 ? &ext[next-1] : 0;
+    if(e && fbn < e->lbn + e->len){
+      x = e->bn + (fbn - e->lbn);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = nextblock();
+      if(e && e->bn + e->len == x){
+        e->len++;
+      } else {
+        assert(next < MAXEXTENT);
+        ext[next].lbn = fbn;
+        ext[next].bn = x;
+        ext[next].len = 1;
+        next++;
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      wextents(&din, ext, next);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -0,0 +1,42 @@
+// Report how much of the time each CPU spent halted with
+// nothing to run, over an interval or, with 0, since boot.
+//   cpuidle [ticks]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+struct cpustats st0[NCPU], st1[NCPU];
+
+int
+main(int argc, char *argv[])
+{
+  int ticks, n, i;
+  uint64 time, idle;
+
+  ticks = 10;
+  if(argc > 1)
+    ticks = atoi(argv[1]);
+  if(ticks < 0){
+    fprintf(2, "usage: cpuidle [ticks]\n");
+    exit(1);
+  }
+
+  if(ticks > 0){
+    cpustats(st0, NCPU);
+    sleep(ticks);
+  }
+  if((n = cpustats(st1, NCPU)) < 0){
+    fprintf(2, "cpuidle: cpustats failed\n");
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    time = st1[i].time - st0[i].time;
+    idle = st1[i].idle - st0[i].idle;
+    printf("cpu %d: %d%% idle, %d wakeups\n", i,
+      time ? (int)(idle * 100 / time) : 0,
+      (int)(st1[i].wakeups - st0[i].wakeups));
+  }
+  exit(0);
+}
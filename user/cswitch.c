@@ -0,0 +1,73 @@
+// Measure context switch latency: two processes pass a byte
+// back and forth over a pair of pipes, so that every hop is a
+// wakeup and a switch. Optional spinners keep other CPUs busy,
+// so that the scheduler also has runnable work to sort through.
+//   cswitch [rounds [spinners]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int rounds, nspin, i, pid, t0, t;
+  int ping[2], pong[2];
+  int spin[8];
+  char c;
+
+  rounds = 2000;
+  nspin = 0;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    nspin = atoi(argv[2]);
+  if(rounds < 1 || nspin < 0 || nspin > sizeof(spin)/sizeof(spin[0])){
+    fprintf(2, "usage: cswitch [rounds [spinners (0-8)]]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < nspin; i++){
+    if((spin[i] = fork()) == 0)
+      for(;;)
+        ;
+  }
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "cswitch: pipe failed\n");
+    exit(1);
+  }
+  if((pid = fork()) == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  c = 'x';
+  t0 = uptime();
+  for(i = 0; i < rounds; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "cswitch: ping-pong failed\n");
+      break;
+    }
+  }
+  t = uptime() - t0;
+  close(ping[1]);
+  wait(0);
+
+  printf("%d round trips (%d switches), %d spinners: %d ticks",
+    i, 2*i, nspin, t);
+  if(t > 0)
+    printf(", %d switches/tick", 2*i / t);
+  printf("\n");
+
+  for(i = 0; i < nspin; i++){
+    kill(spin[i]);
+    wait(0);
+  }
+  exit(0);
+}
@@ -0,0 +1,74 @@
+// Time creating, looking up and removing many files in one
+// directory, to measure directory lookup cost.
+//   dirbench [nfiles]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+char name[32];
+
+// Set name to "dirbench.d/fNNNNN" for file i.
+void
+mkname(int i)
+{
+  int k;
+
+  strcpy(name, "dirbench.d/f");
+  for(k = 16; k >= 12; k--){
+    name[k] = '0' + i % 10;
+    i /= 10;
+  }
+  name[17] = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, fd, t0;
+
+  n = 10000;
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  if(mkdir("dirbench.d") < 0){
+    fprintf(2, "dirbench: cannot mkdir dirbench.d\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      fprintf(2, "dirbench: create %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+  }
+  printf("create %d files: %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if((fd = open(name, O_RDONLY)) < 0){
+      fprintf(2, "dirbench: open %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+  }
+  printf("look up %d files: %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if(unlink(name) < 0){
+      fprintf(2, "dirbench: unlink %s failed\n", name);
+      exit(1);
+    }
+  }
+  printf("remove %d files: %d ticks\n", n, uptime() - t0);
+
+  unlink("dirbench.d");
+  exit(0);
+}
@@ -27,8 +27,8 @@ fmtnames(char *path)
 void find(char *path ,char *file)
 {
     char buf[512], *p;
-    int fd;
-    struct dirent de;
+    int fd, i, n;
+    struct dirinfo de[16];
     struct stat st;
     //printf("begin ls , ths path length is %d,the path is %s\n",strlen(path),path);
     if((fd = open(path, O_RDONLY)) < 0){
@@ -58,31 +58,26 @@ void find(char *path ,char *file)
             *p++ = '/';
             // p此时是指向了buf中的某一个位置
             //printf("before ls , the dir is %s\n",buf);
-            while(read(fd, &de, sizeof(de)) == sizeof(de)){
-                if(de.inum == 0)
-                    continue;
-                memmove(p, de.name, DIRSIZ);
+            while((n = getdents(fd, de, sizeof(de)/sizeof(de[0]))) > 0){
+              for(i = 0; i < n; i++){
+                memmove(p, de[i].name, DIRSIZ);
                 p[DIRSIZ] = 0;
                 //printf("inner,is %s\n",buf);
-                if(stat(buf, &st) < 0){
-                    printf("ls: cannot stat %s\n", buf);
-                    continue;
-                }
                 char *fmtname = fmtnames(buf);
                 //printf("gonna check fmtname:%s\n",fmtname);
                // printf("cmp:%s,%d\n",fmtname,strcmp(fmtname,"."));
                 //printf("cmp:%s,%d\n",fmtname,strcmp(fmtname,".."));
-                if(st.type == T_DIR && strcmp(fmtname,".") !=0 && strcmp(fmtname,"..") != 0){
-                    char tmp[512];
-                    memcpy(tmp,buf,sizeof buf);
-                    //printf("i am dict,dir:%s\n",tmp);
-                    find(tmp,file);
+                if(de[i].type == T_DIR && strcmp(fmtname,".") !=0 && strcmp(fmtname,"..") != 0){
+                    // the call only reads buf, so no copy is needed;
+                    // that keeps each level small on the one-page stack.
+                    find(buf,file);
                 }
 
                 if(strcmp(fmtname,file) == 0){
                     printf("%s\n",buf);
                 }
                 //printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
+              }
             }
             break;
     }
@@ -0,0 +1,101 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+// Report how fragmented the files under a directory are:
+// a file in one extent can be read without seeking, and
+// each extra extent costs a seek.
+
+struct extent ext[MAXEXTENT];
+int vflag;
+int nfiles, nblocks, nextents, nfragged;
+
+void
+frag(char *path)
+{
+  char buf[512], *p;
+  int fd, n, i, blocks;
+  struct dirent de;
+  struct stat st;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    fprintf(2, "frag: cannot open %s\n", path);
+    return;
+  }
+
+  if(fstat(fd, &st) < 0){
+    fprintf(2, "frag: cannot stat %s\n", path);
+    close(fd);
+    return;
+  }
+
+  switch(st.type){
+  case T_FILE:
+    if((n = fmap(fd, ext, MAXEXTENT)) < 0){
+      fprintf(2, "frag: cannot map %s\n", path);
+      break;
+    }
+    blocks = 0;
+    for(i = 0; i < n; i++)
+      blocks += EXTLEN(&ext[i]);
+    nfiles++;
+    nblocks += blocks;
+    nextents += n;
+    if(n > 1)
+      nfragged++;
+    if(vflag){
+      printf("%s: %d blocks in %d extents", path, blocks, n);
+      for(i = 0; i < n; i++)
+        printf(" %d+%d%s", ext[i].bn, EXTLEN(&ext[i]),
+          (ext[i].len & EXT_UNWRITTEN) ? "u" : "");
+      printf("\n");
+    }
+    break;
+
+  case T_DIR:
+    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
+      printf("frag: path too long\n");
+      break;
+    }
+    strcpy(buf, path);
+    p = buf+strlen(buf);
+    if(p[-1] != '/')
+      *p++ = '/';
+    while(read(fd, &de, sizeof(de)) == sizeof(de)){
+      if(de.inum == 0)
+        continue;
+      if(strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0)
+        continue;
+      memmove(p, de.name, DIRSIZ);
+      p[DIRSIZ] = 0;
+      frag(buf);
+    }
+    break;
+  }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  i = 1;
+  if(argc > 1 && strcmp(argv[1], "-v") == 0){
+    vflag = 1;
+    i++;
+  }
+  if(i == argc)
+    frag("/");
+  for(; i < argc; i++)
+    frag(argv[i]);
+
+  printf("%d files, %d blocks, %d extents, %d fragmented files\n",
+         nfiles, nblocks, nextents, nfragged);
+  if(nfiles > 0)
+    printf("%d.%d%d extents per file\n", nextents / nfiles,
+           nextents * 10 / nfiles % 10, nextents * 100 / nfiles % 10);
+  exit(0);
+}
@@ -27,8 +27,8 @@ void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, i, n;
+  struct dirinfo de[32];
   struct stat st;
   printf("begin ls , ths path length is %d\n",strlen(path));
   if((fd = open(path, O_RDONLY)) < 0){
@@ -57,17 +57,12 @@ ls(char *path)
     p = buf+strlen(buf);
     *p++ = '/';
     printf("before ls , the dir is %s\n",buf);
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
+    while((n = getdents(fd, de, sizeof(de)/sizeof(de[0]))) > 0){
+      for(i = 0; i < n; i++){
+        memmove(p, de[i].name, DIRSIZ);
+        p[DIRSIZ] = 0;
+        printf("%s %d %d %d\n", fmtname(buf), de[i].type, de[i].inum, de[i].size);
       }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
     break;
   }
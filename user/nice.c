@@ -0,0 +1,28 @@
+// Run a command at a lower scheduling priority.
+//   nice level command [args...]
+// Level 0 is the highest; the command and its children never
+// run above the given level.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int level;
+
+  if(argc < 3){
+    fprintf(2, "usage: nice level command [args...]\n");
+    exit(1);
+  }
+  level = atoi(argv[1]);
+  if(level < 0 || level >= NPRIO || setpriority(0, level) < 0){
+    fprintf(2, "nice: level must be 0 to %d\n", NPRIO-1);
+    exit(1);
+  }
+  exec(argv[2], argv+2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
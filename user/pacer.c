@@ -0,0 +1,95 @@
+// Measure how late a pacer wakes: a loop that wants to run
+// every period microseconds sleeps until its next deadline,
+// with nanosleep() or, for comparison, with sleep(1), then
+// notes how far past the deadline it woke. Optional spinners
+// keep the CPUs busy meanwhile.
+//   pacer [rounds [period-us [spinners]]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MAXROUNDS 1000
+
+uint64 late[MAXROUNDS];
+
+void
+sort(uint64 *a, int n)
+{
+  int i, j;
+  uint64 x;
+
+  for(i = 1; i < n; i++){
+    x = a[i];
+    for(j = i; j > 0 && a[j-1] > x; j--)
+      a[j] = a[j-1];
+    a[j] = x;
+  }
+}
+
+void
+run(char *what, int usens, int rounds, uint64 period)
+{
+  uint64 next, now;
+  int i;
+
+  next = nanouptime();
+  for(i = 0; i < rounds; i++){
+    next += period;
+    now = nanouptime();
+    if(now < next){
+      if(usens)
+        nanosleep(next - now);
+      else
+        sleep(1);
+    }
+    now = nanouptime();
+    late[i] = now > next ? now - next : 0;
+    if(!usens && now > next)
+      next = now;  // sleep(1) cannot keep up; don't pile up
+  }
+  sort(late, rounds);
+  printf("%s: late by median %d us, 99th %d us, worst %d us\n", what,
+    (int)(late[rounds/2] / 1000), (int)(late[rounds*99/100] / 1000),
+    (int)(late[rounds-1] / 1000));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds, nspin, i;
+  int spin[8];
+  uint64 period;
+
+  rounds = 200;
+  period = 1000;
+  nspin = 0;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    period = atoi(argv[2]);
+  if(argc > 3)
+    nspin = atoi(argv[3]);
+  if(rounds < 1 || rounds > MAXROUNDS || period < 1 ||
+     nspin < 0 || nspin > sizeof(spin)/sizeof(spin[0])){
+    fprintf(2, "usage: pacer [rounds (1-%d) [period-us [spinners (0-8)]]]\n",
+      MAXROUNDS);
+    exit(1);
+  }
+  period *= 1000;
+
+  for(i = 0; i < nspin; i++){
+    if((spin[i] = fork()) == 0)
+      for(;;)
+        ;
+  }
+
+  run("nanosleep", 1, rounds, period);
+  run("sleep(1) ", 0, rounds < 20 ? rounds : 20, period);
+
+  for(i = 0; i < nspin; i++){
+    kill(spin[i]);
+    wait(0);
+  }
+  exit(0);
+}
@@ -0,0 +1,68 @@
+// Measure interactive response time under CPU load: while
+// spinners keep the CPUs busy, a process repeatedly sleeps for
+// a tick and sees how long it takes to get the CPU back. With
+// priorities the sleeper should stay near the top level and
+// the spinners sink below it. If nice is given, the spinners
+// also run at that level.
+//   respbench [rounds [spinners [nice]]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int rounds, nspin, level, i, t, t0, total, worst;
+  int spin[8];
+
+  rounds = 100;
+  nspin = 4;
+  level = -1;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    nspin = atoi(argv[2]);
+  if(argc > 3)
+    level = atoi(argv[3]);
+  if(rounds < 1 || nspin < 0 || nspin > sizeof(spin)/sizeof(spin[0]) ||
+     level >= NPRIO){
+    fprintf(2, "usage: respbench [rounds [spinners (0-8) [nice (0-%d)]]]\n",
+      NPRIO-1);
+    exit(1);
+  }
+
+  for(i = 0; i < nspin; i++){
+    if((spin[i] = fork()) == 0){
+      if(level >= 0)
+        setpriority(0, level);
+      for(;;)
+        ;
+    }
+  }
+  // let the spinners use up their quanta.
+  sleep(5);
+
+  total = worst = 0;
+  for(i = 0; i < rounds; i++){
+    t0 = uptime();
+    sleep(1);
+    t = uptime() - t0;
+    total += t;
+    if(t > worst)
+      worst = t;
+  }
+
+  printf("%d spinners", nspin);
+  if(level >= 0)
+    printf(" at level %d", level);
+  printf(": %d sleeps of 1 tick took %d ticks, worst %d\n",
+    rounds, total, worst);
+
+  for(i = 0; i < nspin; i++){
+    kill(spin[i]);
+    wait(0);
+  }
+  exit(0);
+}
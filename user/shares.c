@@ -0,0 +1,117 @@
+// Check that SCHED_FAIR gives processes CPU in proportion to
+// their weights: run a spinner per weight for a while, then
+// compare the share of CPU time each got with its weight's
+// share. No spinner can use more than one CPU, so with more
+// CPUs the share it can get is capped at one CPU's worth, and
+// what that leaves is shared out among the rest; with no more
+// spinners than CPUs, each just gets one.
+//   shares [-t ticks] weight...
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/sched.h"
+#include "user/user.h"
+
+#define MAXSPIN 8
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, ticks, pid[MAXSPIN], weight[MAXSPIN], want[MAXSPIN];
+  int wsum, wrem, rem, cap, ncpu, more, got, err, worst;
+  uint64 run[MAXSPIN], rsum;
+  struct schedinfo si;
+  struct cpustats st;
+
+  ticks = 50;
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-t") == 0){
+    ticks = atoi(argv[2]);
+    i = 3;
+  }
+  n = argc - i;
+  if(n < 1 || n > MAXSPIN || ticks < 1){
+    fprintf(2, "usage: shares [-t ticks] weight... (1-%d weights)\n", MAXSPIN);
+    exit(1);
+  }
+  wsum = 0;
+  for(n = 0; i < argc; i++, n++){
+    weight[n] = atoi(argv[i]);
+    if(weight[n] < 1 || weight[n] > SCHED_MAXWEIGHT){
+      fprintf(2, "shares: weights must be 1 to %d\n", SCHED_MAXWEIGHT);
+      exit(1);
+    }
+    wsum += weight[n];
+  }
+
+  // the share each should get, in tenths of a percent: in
+  // proportion to weight, but at most one CPU's worth.
+  if((ncpu = cpustats(&st, 0)) < 1)
+    ncpu = 1;
+  cap = 1000 / (n < ncpu ? n : ncpu);
+  for(i = 0; i < n; i++)
+    want[i] = -1;
+  rem = 1000;
+  wrem = wsum;
+  do {
+    more = 0;
+    for(i = 0; i < n; i++){
+      if(want[i] < 0 && weight[i] * rem / wrem > cap){
+        want[i] = cap;
+        rem -= cap;
+        wrem -= weight[i];
+        more = 1;
+      }
+    }
+  } while(more);
+  for(i = 0; i < n; i++)
+    if(want[i] < 0)
+      want[i] = weight[i] * rem / wrem;
+
+  for(i = 0; i < n; i++){
+    if((pid[i] = fork()) < 0){
+      fprintf(2, "shares: fork failed\n");
+      exit(1);
+    }
+    if(pid[i] == 0){
+      if(setsched(0, SCHED_FAIR, weight[i]) < 0)
+        exit(1);
+      for(;;)
+        ;
+    }
+  }
+
+  sleep(ticks);
+
+  rsum = 0;
+  for(i = 0; i < n; i++){
+    if(getsched(pid[i], &si) < 0 || si.class != SCHED_FAIR){
+      fprintf(2, "shares: spinner %d is not running fair\n", pid[i]);
+      exit(1);
+    }
+    run[i] = si.runtime;
+    rsum += run[i];
+  }
+  for(i = 0; i < n; i++){
+    kill(pid[i]);
+    wait(0);
+  }
+  if(rsum == 0){
+    fprintf(2, "shares: the spinners did not run\n");
+    exit(1);
+  }
+
+  // shares in tenths of a percent.
+  worst = 0;
+  for(i = 0; i < n; i++){
+    got = run[i] * 1000 / rsum;
+    err = got > want[i] ? got - want[i] : want[i] - got;
+    if(err > worst)
+      worst = err;
+    printf("weight %d: wanted %d.%d%%, got %d.%d%%\n",
+      weight[i], want[i] / 10, want[i] % 10, got / 10, got % 10);
+  }
+  printf("worst error %d.%d%% over %d ticks on %d CPUs\n",
+    worst / 10, worst % 10, ticks, ncpu);
+  exit(0);
+}
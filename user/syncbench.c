@@ -0,0 +1,72 @@
+// Time small appends to a file: with synchronous commit, where
+// every write() waits for the log; with asynchronous commit and
+// no fsync(); and with asynchronous commit and an fsync() or
+// fdatasync() after every write().
+//   syncbench [nwrites [size]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+char buf[1024];
+
+enum { NONE, FSYNC, FDATASYNC };
+
+void
+run(char *what, int async, int sync, int n, int size)
+{
+  int fd, i, t0, t;
+
+  logasync(async);
+  unlink("syncbench.f");
+  if((fd = open("syncbench.f", O_CREATE|O_RDWR)) < 0){
+    fprintf(2, "syncbench: cannot create syncbench.f\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if(write(fd, buf, size) != size){
+      fprintf(2, "syncbench: write failed\n");
+      exit(1);
+    }
+    if(sync == FSYNC)
+      fsync(fd);
+    else if(sync == FDATASYNC)
+      fdatasync(fd);
+  }
+  fsync(fd);
+  t = uptime() - t0;
+  close(fd);
+  printf("%s: %d writes of %d bytes in %d ticks", what, n, size, t);
+  if(t > 0)
+    printf(", %d writes/tick", n / t);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, size, old;
+
+  n = 500;
+  size = 64;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    size = atoi(argv[2]);
+  if(n < 1 || size < 1 || size > sizeof(buf)){
+    fprintf(2, "syncbench: size must be 1 to %d\n", sizeof(buf));
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+
+  old = logasync(-1);
+  run("sync commit           ", 0, NONE, n, size);
+  run("async, no fsync       ", 1, NONE, n, size);
+  run("async, fsync each     ", 1, FSYNC, n, size);
+  run("async, fdatasync each ", 1, FDATASYNC, n, size);
+  logasync(old);
+  unlink("syncbench.f");
+  exit(0);
+}
@@ -0,0 +1,183 @@
+// Walk a directory tree two ways and report the system calls
+// and time each takes: reading one dirent per read() and
+// stat()ing every entry to learn its type, as ls and find used
+// to, or reading many entries, with their types, per getdents().
+//   treewalk [depth [fanout]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+int nsys;     // system calls made by the current walk
+int nent;     // entries seen by the current walk
+
+// Append /name to the path that ends at p.
+void
+addname(char *p, char *name)
+{
+  *p++ = '/';
+  memmove(p, name, DIRSIZ);
+  p[DIRSIZ] = 0;
+}
+
+// Make a tree under path, with fanout files and, if depth > 0,
+// fanout subdirectories in every directory.
+void
+build(char *path, int depth, int fanout)
+{
+  char buf[128], name[DIRSIZ], *p;
+  int i, fd;
+
+  if(mkdir(path) < 0){
+    fprintf(2, "treewalk: cannot mkdir %s\n", path);
+    exit(1);
+  }
+  strcpy(buf, path);
+  p = buf + strlen(buf);
+  memset(name, 0, sizeof(name));
+  for(i = 0; i < fanout; i++){
+    name[0] = 'f';
+    name[1] = 'a' + i;
+    addname(p, name);
+    if((fd = open(buf, O_CREATE|O_RDWR)) < 0){
+      fprintf(2, "treewalk: cannot create %s\n", buf);
+      exit(1);
+    }
+    close(fd);
+    if(depth > 0){
+      name[0] = 'd';
+      addname(p, name);
+      build(buf, depth-1, fanout);
+    }
+  }
+}
+
+// Walk with read() and stat(). stat() is done as ulib's used
+// to do it, with open(), fstat() and close(), so that each of
+// its system calls is counted.
+void
+walkread(char *path)
+{
+  char buf[128], *p;
+  int fd, efd, r;
+  struct dirent de;
+  struct stat st;
+
+  nsys++;
+  if((fd = open(path, O_RDONLY)) < 0)
+    return;
+  strcpy(buf, path);
+  p = buf + strlen(buf);
+  for(;;){
+    nsys++;
+    if(read(fd, &de, sizeof(de)) != sizeof(de))
+      break;
+    if(de.inum == 0)
+      continue;
+    nent++;
+    addname(p, de.name);
+    nsys++;
+    if((efd = open(buf, O_RDONLY)) < 0)
+      continue;
+    nsys += 2;
+    r = fstat(efd, &st);
+    close(efd);
+    if(r < 0)
+      continue;
+    if(st.type == T_DIR && strcmp(p+1, ".") != 0 && strcmp(p+1, "..") != 0)
+      walkread(buf);
+  }
+  nsys++;
+  close(fd);
+}
+
+// Walk with getdents().
+void
+walkdents(char *path)
+{
+  char buf[128], *p;
+  int fd, i, n;
+  struct dirinfo de[16];
+
+  nsys++;
+  if((fd = open(path, O_RDONLY)) < 0)
+    return;
+  strcpy(buf, path);
+  p = buf + strlen(buf);
+  for(;;){
+    nsys++;
+    if((n = getdents(fd, de, sizeof(de)/sizeof(de[0]))) <= 0)
+      break;
+    for(i = 0; i < n; i++){
+      nent++;
+      addname(p, de[i].name);
+      if(de[i].type == T_DIR && strcmp(p+1, ".") != 0 && strcmp(p+1, "..") != 0)
+        walkdents(buf);
+    }
+  }
+  nsys++;
+  close(fd);
+}
+
+// Remove the tree under path.
+void
+removetree(char *path)
+{
+  char buf[128], *p;
+  int fd, i, n;
+  struct dirinfo de[16];
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return;
+  strcpy(buf, path);
+  p = buf + strlen(buf);
+  while((n = getdents(fd, de, sizeof(de)/sizeof(de[0]))) > 0){
+    for(i = 0; i < n; i++){
+      addname(p, de[i].name);
+      if(strcmp(p+1, ".") == 0 || strcmp(p+1, "..") == 0)
+        continue;
+      if(de[i].type == T_DIR)
+        removetree(buf);
+      else
+        unlink(buf);
+    }
+  }
+  close(fd);
+  unlink(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int depth, fanout, t0;
+
+  depth = 3;
+  fanout = 6;
+  if(argc > 1)
+    depth = atoi(argv[1]);
+  if(argc > 2)
+    fanout = atoi(argv[2]);
+  if(fanout < 1 || fanout > 26){
+    fprintf(2, "treewalk: fanout must be 1 to 26\n");
+    exit(1);
+  }
+
+  build("treewalk.d", depth, fanout);
+
+  nsys = nent = 0;
+  t0 = uptime();
+  walkread("treewalk.d");
+  printf("read+stat: %d entries, %d system calls, %d ticks\n",
+    nent, nsys, uptime() - t0);
+
+  nsys = nent = 0;
+  t0 = uptime();
+  walkdents("treewalk.d");
+  printf("getdents:  %d entries, %d system calls, %d ticks\n",
+    nent, nsys, uptime() - t0);
+
+  removetree("treewalk.d");
+  exit(0);
+}
@@ -1,4 +1,10 @@
 struct stat;
+struct extent;
+struct istats;
+struct iovec;
+struct dirinfo;
+struct schedinfo;
+struct cpustats;
 
 // system calls
 int fork(void);
@@ -22,6 +28,26 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fmap(int, struct extent*, int);
+int istats(struct istats*);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int getdents(int, struct dirinfo*, int);
+int fstatat(int, const char*, struct stat*);
+int sendfile(int, int, int, int);
+int splice(int, int, int);
+int fsync(int);
+int fdatasync(int);
+int logasync(int);
+int fallocate(int, int, int, int);
+int setpriority(int, int);
+int setsched(int, int, int);
+int getsched(int, struct schedinfo*);
+int cpustats(struct cpustats*, int);
+int nanosleep(uint64);
+uint64 nanouptime(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uio.h"
+#include "kernel/sched.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -342,12 +344,13 @@ truncate1(char *s)
 }
 
 // write to an open FD whose file has just been truncated.
-// this causes a write at an offset beyond the end of the file.
-// such writes fail on xv6 (unlike POSIX) but at least
-// they don't crash.
+// this causes a write at an offset beyond the end of the file,
+// which, as in POSIX, succeeds and leaves a hole of zeros.
 void
 truncate2(char *s)
 {
+  char buf[8];
+
   unlink("truncfile");
 
   int fd1 = open("truncfile", O_CREATE|O_TRUNC|O_WRONLY);
@@ -356,14 +359,22 @@ truncate2(char *s)
   int fd2 = open("truncfile", O_TRUNC|O_WRONLY);
 
   int n = write(fd1, "x", 1);
-  if(n != -1){
-    printf("%s: write returned %d, expected -1\n", s, n);
+  if(n != 1){
+    printf("%s: write returned %d, expected 1\n", s, n);
+    exit(1);
+  }
+
+  int fd3 = open("truncfile", O_RDONLY);
+  n = read(fd3, buf, sizeof(buf));
+  if(n != 5 || memcmp(buf, "\0\0\0\0x", 5) != 0){
+    printf("%s: read %d bytes, expected a hole and x\n", s, n);
     exit(1);
   }
 
   unlink("truncfile");
   close(fd1);
   close(fd2);
+  close(fd3);
 }
 
 void
@@ -1916,249 +1927,1197 @@ dirfile(char *s)
   close(fd);
 }
 
-// test that iput() is called at the end of _namei().
-// also tests empty file names.
+// a small file is kept in its inode; check that it survives
+// growing out of it, and shrinking back by truncation.
 void
-iref(char *s)
+inlinefile(char *s)
 {
-  int i, fd;
+  enum { SMALL = 100, BIG = 2000 };
+  int fd, i;
 
-  for(i = 0; i < NINODE + 1; i++){
-    if(mkdir("irefd") != 0){
-      printf("%s: mkdir irefd failed\n", s);
+  unlink("inlinefile");
+  fd = open("inlinefile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create inlinefile\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BIG; i++)
+    buf[i] = 'a' + i % 23;
+  if(write(fd, buf, SMALL) != SMALL){
+    printf("%s: write small failed\n", s);
+    exit(1);
+  }
+  if(write(fd, buf + SMALL, BIG - SMALL) != BIG - SMALL){
+    printf("%s: write big failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("inlinefile", O_RDONLY);
+  if(fd < 0 || read(fd, buf + BIG, BIG + 1) != BIG){
+    printf("%s: read big failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(memcmp(buf, buf + BIG, BIG) != 0){
+    printf("%s: wrong content after growing\n", s);
+    exit(1);
+  }
+
+  fd = open("inlinefile", O_RDWR | O_TRUNC);
+  if(fd < 0 || write(fd, "xyz", 3) != 3){
+    printf("%s: rewrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inlinefile", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 10) != 3 || memcmp(buf, "xyz", 3) != 0){
+    printf("%s: wrong content after truncate\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("inlinefile");
+}
+
+// many small appends, read back through another descriptor
+// before they reach the disk, and a file unlinked before they
+// do.
+void
+delayalloc(char *s)
+{
+  enum { N = 40, SZ = 300 };
+  int fd, fd2, i;
+
+  unlink("delayalloc");
+  fd = open("delayalloc", O_CREATE | O_RDWR);
+  fd2 = open("delayalloc", O_RDONLY);
+  if(fd < 0 || fd2 < 0){
+    printf("%s: cannot create delayalloc\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, 'a' + i % 26, SZ);
+    if(write(fd, buf, SZ) != SZ){
+      printf("%s: write %d failed\n", s, i);
       exit(1);
     }
-    if(chdir("irefd") != 0){
-      printf("%s: chdir irefd failed\n", s);
+    if(read(fd2, buf, SZ+1) != SZ || buf[0] != 'a' + i % 26 || buf[SZ-1] != 'a' + i % 26){
+      printf("%s: read %d back failed\n", s, i);
       exit(1);
     }
-
-    mkdir("");
-    link("README", "");
-    fd = open("", O_CREATE);
-    if(fd >= 0)
-      close(fd);
-    fd = open("xx", O_CREATE);
-    if(fd >= 0)
-      close(fd);
-    unlink("xx");
   }
+  close(fd2);
+  close(fd);
 
-  // clean up
-  for(i = 0; i < NINODE + 1; i++){
-    chdir("..");
-    unlink("irefd");
+  fd = open("delayalloc", O_RDONLY);
+  for(i = 0; i < N; i++){
+    if(read(fd, buf, SZ) != SZ || buf[0] != 'a' + i % 26 || buf[SZ-1] != 'a' + i % 26){
+      printf("%s: reread %d failed\n", s, i);
+      exit(1);
+    }
   }
+  close(fd);
 
-  chdir("/");
+  fd = open("delayalloc", O_RDWR | O_TRUNC);
+  for(i = 0; i < N; i++)
+    write(fd, buf, SZ);
+  if(unlink("delayalloc") != 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  close(fd);
 }
 
-// test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// pread and pwrite use their own offset, not the file's.
 void
-forktest(char *s)
+preadwrite(char *s)
 {
-  enum{ N = 1000 };
-  int n, pid;
+  int fd, p[2];
+  char b[8];
 
-  for(n=0; n<N; n++){
-    pid = fork();
-    if(pid < 0)
-      break;
-    if(pid == 0)
-      exit(0);
+  unlink("prw");
+  fd = open("prw", O_CREATE | O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf("%s: create prw failed\n", s);
+    exit(1);
   }
-
-  if (n == 0) {
-    printf("%s: no fork at all!\n", s);
+  if(pread(fd, b, 4, 3) != 4 || memcmp(b, "3456", 4) != 0){
+    printf("%s: pread failed\n", s);
     exit(1);
   }
-
-  if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+  if(pwrite(fd, "ab", 2, 8) != 2 || pwrite(fd, "cd", 2, 10) != 2){
+    printf("%s: pwrite failed\n", s);
     exit(1);
   }
-
-  for(; n > 0; n--){
-    if(wait(0) < 0){
-      printf("%s: wait stopped early\n", s);
-      exit(1);
-    }
+  // the file offset is still at 10.
+  if(write(fd, "X", 1) != 1 || pread(fd, b, 8, 6) != 6 || memcmp(b, "67abXd", 6) != 0){
+    printf("%s: offsets mixed up\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 1, 100) != 0){
+    printf("%s: pread past end\n", s);
+    exit(1);
   }
+  close(fd);
+  unlink("prw");
 
-  if(wait(0) != -1){
-    printf("%s: wait got too many\n", s);
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
     exit(1);
   }
+  if(pread(p[0], b, 1, 0) != -1){
+    printf("%s: pread on a pipe\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
 }
 
+// getdents returns every live entry once, with its type and
+// size, however few it is asked for at a time.
 void
-sbrkbasic(char *s)
+getdentstest(char *s)
 {
-  enum { TOOMUCH=1024*1024*1024};
-  int i, pid, xstatus;
-  char *c, *a, *b;
+  int fd, i, n, tot, seen;
+  struct dirinfo de[3];
+  char name[8];
 
-  // does sbrk() return the expected failure value?
-  pid = fork();
-  if(pid < 0){
-    printf("fork failed in sbrkbasic\n");
+  if(mkdir("gdd") < 0){
+    printf("%s: mkdir gdd failed\n", s);
     exit(1);
   }
-  if(pid == 0){
-    a = sbrk(TOOMUCH);
-    if(a == (char*)0xffffffffffffffffL){
-      // it's OK if this fails.
-      exit(0);
-    }
-    
-    for(b = a; b < a+TOOMUCH; b += 4096){
-      *b = 99;
+  strcpy(name, "gdd/f0");
+  for(i = 0; i < 10; i++){
+    name[5] = '0' + i;
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0 || write(fd, name, i) != i){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
     }
-    
-    // we should not get here! either sbrk(TOOMUCH)
-    // should have failed, or (with lazy allocation)
-    // a pagefault should have killed this process.
-    exit(1);
+    close(fd);
   }
-
-  wait(&xstatus);
-  if(xstatus == 1){
-    printf("%s: too much memory allocated!\n", s);
+  if(mkdir("gdd/sub") < 0 || unlink("gdd/f3") < 0){
+    printf("%s: mkdir/unlink failed\n", s);
     exit(1);
   }
 
-  // can one sbrk() less than a page?
-  a = sbrk(0);
-  for(i = 0; i < 5000; i++){
-    b = sbrk(1);
-    if(b != a){
-      printf("%s: sbrk test failed %d %x %x\n", s, i, a, b);
+  fd = open("gdd", O_RDONLY);
+  tot = seen = 0;
+  while((n = getdents(fd, de, 3)) > 0){
+    if(n > 3){
+      printf("%s: getdents returned %d entries\n", s, n);
       exit(1);
     }
-    *b = 1;
-    a = b + 1;
+    for(i = 0; i < n; i++){
+      tot++;
+      if(de[i].name[0] == 'f' && de[i].name[2] == 0){
+        if(de[i].name[1] == '3' || de[i].type != T_FILE || de[i].size != de[i].name[1] - '0'){
+          printf("%s: bad entry %s type %d size %d\n", s, de[i].name, de[i].type, de[i].size);
+          exit(1);
+        }
+        seen |= 1 << (de[i].name[1] - '0');
+      } else if(strcmp(de[i].name, "sub") == 0 && de[i].type != T_DIR){
+        printf("%s: sub is not a directory\n", s);
+        exit(1);
+      }
+    }
   }
-  pid = fork();
-  if(pid < 0){
-    printf("%s: sbrk test fork failed\n", s);
+  // ".", "..", nine files and sub.
+  if(n != 0 || tot != 12 || seen != (0x3ff & ~(1 << 3))){
+    printf("%s: getdents saw %d entries\n", s, tot);
     exit(1);
   }
-  c = sbrk(1);
-  c = sbrk(1);
-  if(c != a + 1){
-    printf("%s: sbrk test failed post-fork\n", s);
+  close(fd);
+
+  fd = open("gdd/f0", O_RDONLY);
+  if(getdents(fd, de, 3) != -1){
+    printf("%s: getdents on a file\n", s);
     exit(1);
   }
-  if(pid == 0)
-    exit(0);
-  wait(&xstatus);
-  exit(xstatus);
+  close(fd);
+
+  for(i = 0; i < 10; i++){
+    name[5] = '0' + i;
+    unlink(name);
+  }
+  unlink("gdd/sub");
+  unlink("gdd");
 }
 
+// fstatat looks paths up relative to a directory fd, or to the
+// current directory for AT_FDCWD, without using a descriptor.
 void
-sbrkmuch(char *s)
+fstatattest(char *s)
 {
-  enum { BIG=100*1024*1024 };
-  char *c, *oldbrk, *a, *lastaddr, *p;
-  uint64 amt;
+  int dfd, fd, fds[NOFILE], i, n;
+  struct stat st, st1;
 
-  oldbrk = sbrk(0);
-
-  // can one grow address space to something big?
-  a = sbrk(0);
-  amt = BIG - (uint64)a;
-  p = sbrk(amt);
-  if (p != a) {
-    printf("%s: sbrk test failed to grow big address space; enough phys mem?\n", s);
+  if(mkdir("fsad") < 0 || (fd = open("fsad/x", O_CREATE | O_RDWR)) < 0){
+    printf("%s: create fsad/x failed\n", s);
     exit(1);
   }
+  if(write(fd, "hello", 5) != 5){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
 
-  // touch each page to make sure it exists.
-  char *eee = sbrk(0);
-  for(char *pp = a; pp < eee; pp += 4096)
-    *pp = 1;
-
-  lastaddr = (char*) (BIG-1);
-  *lastaddr = 99;
-
-  // can one de-allocate?
-  a = sbrk(0);
-  c = sbrk(-PGSIZE);
-  if(c == (char*)0xffffffffffffffffL){
-    printf("%s: sbrk could not deallocate\n", s);
+  dfd = open("fsad", O_RDONLY);
+  if(fstatat(dfd, "x", &st) < 0 || st.type != T_FILE || st.size != 5 || st.nlink != 1){
+    printf("%s: fstatat(dfd, x) failed\n", s);
     exit(1);
   }
-  c = sbrk(0);
-  if(c != a - PGSIZE){
-    printf("%s: sbrk deallocation produced wrong address, a %x c %x\n", s, a, c);
+  if(fstatat(AT_FDCWD, "fsad/x", &st1) < 0 || st1.ino != st.ino){
+    printf("%s: fstatat(AT_FDCWD, fsad/x) failed\n", s);
     exit(1);
   }
-
-  // can one re-allocate that page?
-  a = sbrk(0);
-  c = sbrk(PGSIZE);
-  if(c != a || sbrk(0) != a + PGSIZE){
-    printf("%s: sbrk re-allocation failed, a %x c %x\n", s, a, c);
+  if(stat("fsad", &st1) < 0 || st1.type != T_DIR ||
+     fstatat(dfd, "..", &st) < 0 || stat(".", &st1) < 0 || st.ino != st1.ino){
+    printf("%s: stat of directories failed\n", s);
     exit(1);
   }
-  if(*lastaddr == 99){
-    // should be zero
-    printf("%s: sbrk de-allocation didn't really deallocate\n", s);
+  if(fstatat(dfd, "nope", &st) != -1 || fstatat(dfd, "x/y", &st) != -1){
+    printf("%s: fstatat of a missing path succeeded\n", s);
     exit(1);
   }
 
-  a = sbrk(0);
-  c = sbrk(-(sbrk(0) - oldbrk));
-  if(c != a){
-    printf("%s: sbrk downsize failed, a %x c %x\n", s, a, c);
+  // stat needs no file descriptor.
+  for(n = 0; n < NOFILE; n++)
+    if((fds[n] = dup(dfd)) < 0)
+      break;
+  if(stat("fsad/x", &st) < 0){
+    printf("%s: stat with no free descriptors failed\n", s);
     exit(1);
   }
+  for(i = 0; i < n; i++)
+    close(fds[i]);
+  close(dfd);
+
+  unlink("fsad/x");
+  unlink("fsad");
 }
 
-// can we read the kernel's memory?
+// close() of a read-only file and chdir() stay out of the log,
+// so an inode whose last reference they drop is freed later.
 void
-kernmem(char *s)
+orphans(char *s)
 {
-  char *a;
-  int pid;
+  int fd, i;
+  char buf[512];
 
-  for(a = (char*)(KERNBASE); a < (char*) (KERNBASE+2000000); a += 50000){
-    pid = fork();
-    if(pid < 0){
-      printf("%s: fork failed\n", s);
+  fd = open("orph", O_CREATE | O_RDWR);
+  memset(buf, 'o', sizeof(buf));
+  for(i = 0; i < 10; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write orph failed\n", s);
       exit(1);
     }
-    if(pid == 0){
-      printf("%s: oops could read %x = %x\n", s, a, *a);
+  }
+  close(fd);
+
+  fd = open("orph", O_RDONLY);
+  if(fd < 0 || unlink("orph") < 0){
+    printf("%s: open/unlink orph failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'o' || buf[511] != 'o'){
+      printf("%s: read of unlinked orph failed\n", s);
       exit(1);
     }
-    int xstatus;
-    wait(&xstatus);
-    if(xstatus != -1)  // did kernel kill child?
-      exit(1);
+  }
+  close(fd);
+
+  if(mkdir("orphd") < 0 || chdir("orphd") < 0 || unlink("../orphd") < 0){
+    printf("%s: mkdir/chdir/unlink orphd failed\n", s);
+    exit(1);
+  }
+  if(open("x", O_CREATE | O_RDWR) >= 0){
+    printf("%s: created a file in a removed directory\n", s);
+    exit(1);
+  }
+  if(chdir("..") < 0){
+    printf("%s: chdir .. failed\n", s);
+    exit(1);
+  }
+  if(open("orph", O_RDONLY) >= 0 || open("orphd", O_RDONLY) >= 0){
+    printf("%s: orph or orphd still there\n", s);
+    exit(1);
+  }
+  // the next transaction frees both.
+  if(mkdir("orphd") < 0 || unlink("orphd") < 0){
+    printf("%s: mkdir/unlink orphd again failed\n", s);
+    exit(1);
   }
 }
 
-// user code should not be able to write to addresses above MAXVA.
+// sendfile copies a file into a pipe and splice drains the
+// pipe into another file, without going through user memory.
 void
-MAXVAplus(char *s)
+sendfiletest(char *s)
 {
-  volatile uint64 a = MAXVA;
-  for( ; a != 0; a <<= 1){
-    int pid;
-    pid = fork();
-    if(pid < 0){
-      printf("%s: fork failed\n", s);
-      exit(1);
-    }
-    if(pid == 0){
-      *(char*)a = 99;
-      printf("%s: oops wrote %x\n", s, a);
-      exit(1);
-    }
-    int xstatus;
+  enum { N = 5000 };
+  int fd, out, p[2], pid, i, n, xstatus;
+  static char b[N];
+
+  fd = open("sfin", O_CREATE | O_RDWR);
+  for(i = 0; i < N; i++)
+    b[i] = 'a' + i % 23;
+  if(fd < 0 || write(fd, b, N) != N){
+    printf("%s: create sfin failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[1]);
+    out = open("sfout", O_CREATE | O_RDWR);
+    for(i = 0; (n = splice(p[0], out, N)) > 0; i += n)
+      ;
+    exit(i == N - 100 ? 0 : 1);
+  }
+  close(p[0]);
+  fd = open("sfin", O_RDONLY);
+  if(sendfile(p[1], fd, 100, N) != N - 100 || sendfile(p[1], fd, -1, 0) != 0){
+    printf("%s: sendfile failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: splice failed\n", s);
+    exit(1);
+  }
+  // fd's own offset was left alone.
+  if(read(fd, b, 1) != 1 || b[0] != 'a'){
+    printf("%s: sendfile moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("sfout", O_RDONLY);
+  if(read(fd, b, N) != N - 100){
+    printf("%s: sfout is short\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N - 100; i++){
+    if(b[i] != 'a' + (i + 100) % 23){
+      printf("%s: sfout is wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(splice(fd, fd, 1) != -1){
+    printf("%s: splice of a closed fd\n", s);
+    exit(1);
+  }
+  unlink("sfin");
+  unlink("sfout");
+}
+
+// O_DIRECT reads and writes see the same file contents as
+// ordinary ones, in both directions.
+void
+directio(char *s)
+{
+  enum { N = 8 };
+  static char b[N*BSIZE] __attribute__((aligned(BSIZE)));
+  struct iovec iov[2];
+  int fd, i;
+
+  for(i = 0; i < N*BSIZE; i++)
+    b[i] = i % 251;
+  fd = open("dio", O_CREATE | O_RDWR | O_DIRECT);
+  if(fd < 0 || write(fd, b, N*BSIZE) != N*BSIZE || write(fd, "tail", 4) != 4){
+    printf("%s: direct write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("dio", O_RDWR);
+  memset(b, 0, sizeof(b));
+  if(read(fd, b, N*BSIZE) != N*BSIZE || read(fd, b + 10, 10) != 4){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for(i = BSIZE; i < N*BSIZE; i++){
+    if(b[i] != i % 251){
+      printf("%s: direct write not seen at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(pwrite(fd, "cached", 6, 2*BSIZE) != 6){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("dio", O_RDONLY | O_DIRECT);
+  memset(b, 0, sizeof(b));
+  if(read(fd, b, N*BSIZE) != N*BSIZE || memcmp(b + 2*BSIZE, "cached", 6) != 0 ||
+     b[2*BSIZE + 6] != (2*BSIZE + 6) % 251 || b[N*BSIZE - 1] != (N*BSIZE - 1) % 251){
+    printf("%s: direct read wrong\n", s);
+    exit(1);
+  }
+  // an unaligned buffer still works, through the cache.
+  if(pread(fd, b + 1, 6, 2*BSIZE) != 6 || memcmp(b + 1, "cached", 6) != 0){
+    printf("%s: unaligned direct read wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // readv and writev of aligned buffers go direct too.
+  fd = open("dio", O_RDWR | O_DIRECT);
+  memset(b, 'v', 2*BSIZE);
+  iov[0].iov_base = b;
+  iov[0].iov_len = BSIZE;
+  iov[1].iov_base = b + BSIZE;
+  iov[1].iov_len = BSIZE;
+  if(fd < 0 || writev(fd, iov, 2) != 2*BSIZE){
+    printf("%s: direct writev failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("dio", O_RDONLY | O_DIRECT);
+  memset(b, 0, 2*BSIZE);
+  if(fd < 0 || readv(fd, iov, 2) != 2*BSIZE || b[0] != 'v' || b[2*BSIZE-1] != 'v' ||
+     read(fd, b, BSIZE) != BSIZE || memcmp(b, "cached", 6) != 0){
+    printf("%s: direct readv wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("dio");
+}
+
+// fsync() and fdatasync() work with and without asynchronous
+// commit, and an asynchronously committed file reads back.
+void
+fsynctest(char *s)
+{
+  int fd, i, old, fds[2];
+  char b[100];
+
+  if((old = logasync(1)) < 0){
+    printf("%s: logasync failed\n", s);
+    exit(1);
+  }
+  fd = open("fsync", O_CREATE | O_RDWR);
+  for(i = 0; i < 50; i++){
+    memset(b, 'a' + i % 26, sizeof(b));
+    if(write(fd, b, sizeof(b)) != sizeof(b)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(i % 10 == 0 && fdatasync(fd) != 0){
+      printf("%s: fdatasync failed\n", s);
+      exit(1);
+    }
+  }
+  if(fsync(fd) != 0 || fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  logasync(old);
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("fsync", O_RDONLY);
+  for(i = 0; i < 50; i++){
+    if(read(fd, b, sizeof(b)) != sizeof(b) || b[0] != 'a' + i % 26 || b[99] != 'a' + i % 26){
+      printf("%s: wrong data\n", s);
+      exit(1);
+    }
+  }
+  if(read(fd, b, 1) != 0){
+    printf("%s: file too long\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsync");
+
+  // nothing to sync on a pipe.
+  if(pipe(fds) != 0 || fsync(fds[0]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// logasync(1) starts the log flusher, a kernel thread, which
+// takes the next pid; logasync(0) makes it return, and so exit,
+// and init must reap it.
+void
+kthreadexit(char *s)
+{
+  struct schedinfo si;
+  int old, pid, i;
+
+  if((old = logasync(0)) < 0){
+    printf("%s: logasync failed\n", s);
+    exit(1);
+  }
+  // let a flusher left from before finish exiting.
+  sleep(2);
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(0);
+  if(logasync(1) != 0 || getsched(pid+1, &si) != 0){
+    printf("%s: no log flusher at pid %d\n", s, pid+1);
+    exit(1);
+  }
+  logasync(0);
+  for(i = 0; i < 50 && getsched(pid+1, &si) == 0; i++)
+    sleep(1);
+  if(i == 50){
+    printf("%s: log flusher %d not reaped\n", s, pid+1);
+    exit(1);
+  }
+  logasync(old);
+}
+
+// fallocate() sets blocks aside that read as zeros until
+// written, and punches holes; writing past the end leaves one.
+void
+falloctest(char *s)
+{
+  int fd, i;
+  struct stat st;
+  char b[BSIZE];
+
+  unlink("falloc");
+  fd = open("falloc", O_CREATE | O_RDWR);
+  if(fd < 0 || fallocate(fd, FALLOC_KEEP_SIZE, 0, 50*BSIZE) != 0){
+    printf("%s: fallocate failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) != 0 || st.size != 0){
+    printf("%s: fallocate changed the size\n", s);
+    exit(1);
+  }
+  memset(b, 'x', sizeof(b));
+  for(i = 0; i < 20; i++){
+    if(write(fd, b, sizeof(b)) != sizeof(b)){
+      printf("%s: write into preallocated blocks failed\n", s);
+      exit(1);
+    }
+  }
+  if(fallocate(fd, 0, 0, 30*BSIZE) != 0 || fstat(fd, &st) != 0 || st.size != 30*BSIZE){
+    printf("%s: fallocate did not grow the file\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, sizeof(b), 25*BSIZE) != sizeof(b) || b[0] != 0 || b[BSIZE-1] != 0){
+    printf("%s: unwritten block not zero\n", s);
+    exit(1);
+  }
+  if(fallocate(fd, FALLOC_PUNCH_HOLE, 5*BSIZE + 1, 5*BSIZE) != 0){
+    printf("%s: punch failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, sizeof(b), 5*BSIZE) != sizeof(b) || b[0] != 'x' || b[1] != 0 ||
+     pread(fd, b, sizeof(b), 8*BSIZE) != sizeof(b) || b[0] != 0 ||
+     pread(fd, b, sizeof(b), 10*BSIZE) != sizeof(b) || b[0] != 0 || b[1] != 'x'){
+    printf("%s: hole reads wrong\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "z", 1, 100*BSIZE) != 1 || fstat(fd, &st) != 0 || st.size != 100*BSIZE + 1 ||
+     pread(fd, b, 1, 60*BSIZE) != 1 || b[0] != 0){
+    printf("%s: write past the end failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("falloc");
+}
+
+// setpriority() reports and changes the level a process may
+// run at, and a child starts at its parent's.
+void
+priotest(char *s)
+{
+  int pid, xst;
+
+  if(setpriority(0, -1) != 0){
+    printf("%s: initial priority not 0\n", s);
+    exit(1);
+  }
+  if(setpriority(0, NPRIO) != -1 || setpriority(0, -1) != 0){
+    printf("%s: bad priority accepted\n", s);
+    exit(1);
+  }
+  if(setpriority(0, NPRIO-1) != 0 || setpriority(getpid(), -1) != NPRIO-1){
+    printf("%s: setpriority did not stick\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(setpriority(0, -1) == NPRIO-1 ? 0 : 1);
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: child did not inherit priority\n", s);
+    exit(1);
+  }
+  if(setpriority(0, 0) != NPRIO-1){
+    printf("%s: could not restore priority\n", s);
+    exit(1);
+  }
+
+  // a process at the lowest level still gets to run
+  // while another at the highest spins.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    for(;;)
+      ;
+  setpriority(0, NPRIO-1);
+  for(xst = 0; xst < 1000000; xst++)
+    getpid();
+  setpriority(0, 0);
+  kill(pid);
+  wait(0);
+  if(setpriority(pid, -1) != -1){
+    printf("%s: setpriority of dead process succeeded\n", s);
+    exit(1);
+  }
+}
+
+// setsched() changes a process's class and weight, getsched()
+// reports them and how long it has run, and a child starts with
+// its parent's.
+void
+schedtest(char *s)
+{
+  struct schedinfo si;
+  struct cpustats st;
+  uint64 t0;
+  int pid, xst, i, ncpu, spin[NCPU+1];
+
+  if(getsched(0, &si) != 0 || si.class != SCHED_MLFQ || si.weight != SCHED_WEIGHT){
+    printf("%s: bad initial class or weight\n", s);
+    exit(1);
+  }
+  if(setsched(0, NSCHED, 0) != -1 || setsched(0, -1, SCHED_MAXWEIGHT+1) != -1 ||
+     setsched(0, -1, -1) != -1){
+    printf("%s: bad class or weight accepted\n", s);
+    exit(1);
+  }
+  if(getsched(-1, &si) != -1 || setpriority(-5, 0) != -1 || kill(-1) != -1 ||
+     getsched(-2147483647-1, &si) != -1){
+    printf("%s: negative pid accepted\n", s);
+    exit(1);
+  }
+  t0 = si.runtime;
+  for(i = 0; i < 1000000; i++)
+    getpid();
+  if(getsched(getpid(), &si) != 0 || si.runtime <= t0){
+    printf("%s: runtime did not grow\n", s);
+    exit(1);
+  }
+
+  if(setsched(0, SCHED_FAIR, 300) != 0){
+    printf("%s: setsched failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(getsched(0, &si) != 0 || si.class != SCHED_FAIR || si.weight != 300)
+      exit(1);
+    exit(0);
+  }
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: child did not inherit class and weight\n", s);
+    exit(1);
+  }
+  if(setsched(0, SCHED_MLFQ, SCHED_WEIGHT) != 0 || getsched(0, &si) != 0 ||
+     si.class != SCHED_MLFQ || si.weight != SCHED_WEIGHT){
+    printf("%s: could not restore class and weight\n", s);
+    exit(1);
+  }
+  if(getsched(pid, &si) != -1){
+    printf("%s: getsched of dead process succeeded\n", s);
+    exit(1);
+  }
+
+  // a SCHED_FAIR spinner still runs, now and then, while
+  // SCHED_MLFQ spinners keep every CPU busy.
+  ncpu = cpustats(&st, 0);
+  for(i = 0; i <= ncpu; i++){
+    if((spin[i] = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(spin[i] == 0){
+      if(i == ncpu && setsched(0, SCHED_FAIR, SCHED_WEIGHT) != 0)
+        exit(1);
+      for(;;)
+        ;
+    }
+    if(i == ncpu - 1)
+      sleep(2);
+  }
+  sleep(2);
+  if(getsched(spin[ncpu], &si) != 0){
+    printf("%s: getsched of fair spinner failed\n", s);
+    exit(1);
+  }
+  t0 = si.runtime;
+  sleep(30);
+  xst = getsched(spin[ncpu], &si);
+  for(i = 0; i <= ncpu; i++){
+    kill(spin[i]);
+    wait(0);
+  }
+  if(xst != 0 || si.runtime <= t0){
+    printf("%s: SCHED_FAIR starved by SCHED_MLFQ\n", s);
+    exit(1);
+  }
+}
+
+// cpustats() reports each running CPU's idle time, which can
+// be no more than its time.
+void
+cpustatstest(char *s)
+{
+  struct cpustats st[NCPU];
+  int n, i;
+
+  n = cpustats(st, NCPU);
+  if(n < 1 || n > NCPU){
+    printf("%s: cpustats returned %d\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(st[i].time == 0 || st[i].idle > st[i].time){
+      printf("%s: cpu %d idle %d of %d\n", s, i, (int)st[i].idle, (int)st[i].time);
+      exit(1);
+    }
+  }
+  if(cpustats(st, 0) != n){
+    printf("%s: cpustats with no room failed\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() sleeps for at least as long as asked, and not
+// much longer; kill() ends it early.
+void
+nanosleeptest(char *s)
+{
+  uint64 t0, t1;
+  int pid, xst;
+
+  t0 = nanouptime();
+  if(nanosleep(2000000) != 0){
+    printf("%s: nanosleep failed\n", s);
+    exit(1);
+  }
+  t1 = nanouptime();
+  if(t1 - t0 < 2000000 || t1 - t0 > 1000000000ULL){
+    printf("%s: nanosleep of 2ms took %d us\n", s, (int)((t1 - t0) / 1000));
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nanosleep(100000000000ULL);
+    exit(0);
+  }
+  nanosleep(1000000);
+  kill(pid);
+  wait(&xst);
+  if(xst != -1){
+    printf("%s: killed sleeper exited with %d\n", s, xst);
+    exit(1);
+  }
+}
+
+// readv and writev gather and scatter, in order.
+void
+rwvec(char *s)
+{
+  int fd;
+  char a[3], b[5], c[10];
+  struct iovec iov[3];
+
+  unlink("rwvec");
+  fd = open("rwvec", O_CREATE | O_RDWR);
+  iov[0].iov_base = "abc";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "defgh";
+  iov[2].iov_len = 5;
+  if(fd < 0 || writev(fd, iov, 3) != 8){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("rwvec", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = c;
+  iov[2].iov_len = sizeof(c);
+  if(readv(fd, iov, 3) != 8 || memcmp(a, "abc", 3) != 0 || memcmp(b, "defgh", 5) != 0){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, IOV_MAX+1) != -1){
+    printf("%s: readv with too many buffers\n", s);
+    exit(1);
+  }
+  // lengths that would overflow the int count.
+  iov[0].iov_len = 0x80000000UL;
+  if(readv(fd, iov, 1) != -1){
+    printf("%s: readv with a 2GB buffer\n", s);
+    exit(1);
+  }
+  iov[0].iov_len = 0x7fffffff;
+  iov[1].iov_len = 1;
+  if(readv(fd, iov, 2) != -1){
+    printf("%s: readv with 2GB of buffers\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("rwvec");
+}
+
+// more distinct inodes in use at once than NINODE.
+void
+manyinodes(char *s)
+{
+  enum { NCHILD = 6, NOPEN = 10 };
+  int ready[2], done[2];
+  int i, j, fd, pid;
+  char name[8], c;
+  struct istats st;
+
+  if(pipe(ready) < 0 || pipe(done) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(done[1]);
+      name[0] = 'm';
+      name[1] = 'i';
+      name[2] = '0' + i;
+      name[4] = 0;
+      for(j = 0; j < NOPEN; j++){
+        name[3] = 'a' + j;
+        if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+        unlink(name);
+      }
+      write(ready[1], "x", 1);
+      read(done[0], &c, 1);  // hold the files open until the parent is done
+      exit(0);
+    }
+  }
+  close(done[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  if(istats(&st) < 0 || st.nactive < NCHILD*NOPEN){
+    printf("%s: istats: %d active\n", s, st.nactive);
+    exit(1);
+  }
+  close(done[1]);
+  for(i = 0; i < NCHILD; i++){
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+}
+
+// test that iput() is called at the end of _namei().
+// also tests empty file names.
+void
+iref(char *s)
+{
+  int i, fd;
+
+  for(i = 0; i < NINODE + 1; i++){
+    if(mkdir("irefd") != 0){
+      printf("%s: mkdir irefd failed\n", s);
+      exit(1);
+    }
+    if(chdir("irefd") != 0){
+      printf("%s: chdir irefd failed\n", s);
+      exit(1);
+    }
+
+    mkdir("");
+    link("README", "");
+    fd = open("", O_CREATE);
+    if(fd >= 0)
+      close(fd);
+    fd = open("xx", O_CREATE);
+    if(fd >= 0)
+      close(fd);
+    unlink("xx");
+  }
+
+  // clean up
+  for(i = 0; i < NINODE + 1; i++){
+    chdir("..");
+    unlink("irefd");
+  }
+
+  chdir("/");
+}
+
+// test that fork fails gracefully
+// the forktest binary also does this, but it runs out of proc entries first.
+// inside the bigger usertests binary, we run out of memory first.
+// N is above NPROC, so that either way fork() must fail.
+void
+forktest(char *s)
+{
+  enum{ N = 5000 };
+  int n, pid;
+
+  for(n=0; n<N; n++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0)
+      exit(0);
+  }
+
+  if (n == 0) {
+    printf("%s: no fork at all!\n", s);
+    exit(1);
+  }
+
+  if(n == N){
+    printf("%s: fork claimed to work %d times!\n", s, N);
+    exit(1);
+  }
+
+  for(; n > 0; n--){
+    if(wait(0) < 0){
+      printf("%s: wait stopped early\n", s);
+      exit(1);
+    }
+  }
+
+  if(wait(0) != -1){
+    printf("%s: wait got too many\n", s);
+    exit(1);
+  }
+}
+
+void
+sbrkbasic(char *s)
+{
+  enum { TOOMUCH=1024*1024*1024};
+  int i, pid, xstatus;
+  char *c, *a, *b;
+
+  // does sbrk() return the expected failure value?
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed in sbrkbasic\n");
+    exit(1);
+  }
+  if(pid == 0){
+    a = sbrk(TOOMUCH);
+    if(a == (char*)0xffffffffffffffffL){
+      // it's OK if this fails.
+      exit(0);
+    }
+    
+    for(b = a; b < a+TOOMUCH; b += 4096){
+      *b = 99;
+    }
+    
+    // we should not get here! either sbrk(TOOMUCH)
+    // should have failed, or (with lazy allocation)
+    // a pagefault should have killed this process.
+    exit(1);
+  }
+
+  wait(&xstatus);
+  if(xstatus == 1){
+    printf("%s: too much memory allocated!\n", s);
+    exit(1);
+  }
+
+  // can one sbrk() less than a page?
+  a = sbrk(0);
+  for(i = 0; i < 5000; i++){
+    b = sbrk(1);
+    if(b != a){
+      printf("%s: sbrk test failed %d %x %x\n", s, i, a, b);
+      exit(1);
+    }
+    *b = 1;
+    a = b + 1;
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: sbrk test fork failed\n", s);
+    exit(1);
+  }
+  c = sbrk(1);
+  c = sbrk(1);
+  if(c != a + 1){
+    printf("%s: sbrk test failed post-fork\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  exit(xstatus);
+}
+
+void
+sbrkmuch(char *s)
+{
+  enum { BIG=100*1024*1024 };
+  char *c, *oldbrk, *a, *lastaddr, *p;
+  uint64 amt;
+
+  oldbrk = sbrk(0);
+
+  // can one grow address space to something big?
+  a = sbrk(0);
+  amt = BIG - (uint64)a;
+  p = sbrk(amt);
+  if (p != a) {
+    printf("%s: sbrk test failed to grow big address space; enough phys mem?\n", s);
+    exit(1);
+  }
+
+  // touch each page to make sure it exists.
+  char *eee = sbrk(0);
+  for(char *pp = a; pp < eee; pp += 4096)
+    *pp = 1;
+
+  lastaddr = (char*) (BIG-1);
+  *lastaddr = 99;
+
+  // can one de-allocate?
+  a = sbrk(0);
+  c = sbrk(-PGSIZE);
+  if(c == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk could not deallocate\n", s);
+    exit(1);
+  }
+  c = sbrk(0);
+  if(c != a - PGSIZE){
+    printf("%s: sbrk deallocation produced wrong address, a %x c %x\n", s, a, c);
+    exit(1);
+  }
+
+  // can one re-allocate that page?
+  a = sbrk(0);
+  c = sbrk(PGSIZE);
+  if(c != a || sbrk(0) != a + PGSIZE){
+    printf("%s: sbrk re-allocation failed, a %x c %x\n", s, a, c);
+    exit(1);
+  }
+  if(*lastaddr == 99){
+    // should be zero
+    printf("%s: sbrk de-allocation didn't really deallocate\n", s);
+    exit(1);
+  }
+
+  a = sbrk(0);
+  c = sbrk(-(sbrk(0) - oldbrk));
+  if(c != a){
+    printf("%s: sbrk downsize failed, a %x c %x\n", s, a, c);
+    exit(1);
+  }
+}
+
+// can we read the kernel's memory?
+void
+kernmem(char *s)
+{
+  char *a;
+  int pid;
+
+  for(a = (char*)(KERNBASE); a < (char*) (KERNBASE+2000000); a += 50000){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      printf("%s: oops could read %x = %x\n", s, a, *a);
+      exit(1);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != -1)  // did kernel kill child?
+      exit(1);
+  }
+}
+
+// user code should not be able to write to addresses above MAXVA.
+void
+MAXVAplus(char *s)
+{
+  volatile uint64 a = MAXVA;
+  for( ; a != 0; a <<= 1){
+    int pid;
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      *(char*)a = 99;
+      printf("%s: oops wrote %x\n", s, a);
+      exit(1);
+    }
+    int xstatus;
     wait(&xstatus);
     if(xstatus != -1)  // did kernel kill child?
       exit(1);
@@ -2617,6 +3576,23 @@ struct test {
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
   {iref, "iref"},
+  {manyinodes, "manyinodes"},
+  {inlinefile, "inlinefile"},
+  {delayalloc, "delayalloc"},
+  {preadwrite, "preadwrite"},
+  {rwvec, "rwvec"},
+  {getdentstest, "getdents"},
+  {fstatattest, "fstatat"},
+  {orphans, "orphans"},
+  {sendfiletest, "sendfile"},
+  {directio, "directio"},
+  {fsynctest, "fsynctest"},
+  {kthreadexit, "kthreadexit"},
+  {falloctest, "falloctest"},
+  {priotest, "priotest"},
+  {schedtest, "schedtest"},
+  {cpustatstest, "cpustats"},
+  {nanosleeptest, "nanosleep"},
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
@@ -2684,6 +3660,65 @@ bigdir(char *s)
   }
 }
 
+// directory big enough to be searched through its hash index
+void
+hashdir(char *s)
+{
+  enum { N = 1000 };
+  int i, fd;
+  char name[16];
+
+  if(mkdir("hd") != 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  strcpy(name, "hd/x000");
+
+  for(i = 0; i < N; i++){
+    name[4] = '0' + (i / 100);
+    name[5] = '0' + (i / 10) % 10;
+    name[6] = '0' + (i % 10);
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  for(i = 0; i < N; i += 2){
+    name[4] = '0' + (i / 100);
+    name[5] = '0' + (i / 10) % 10;
+    name[6] = '0' + (i % 10);
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  for(i = 0; i < N; i++){
+    name[4] = '0' + (i / 100);
+    name[5] = '0' + (i / 10) % 10;
+    name[6] = '0' + (i % 10);
+    fd = open(name, O_RDONLY);
+    if((i % 2 == 0) != (fd < 0)){
+      printf("%s: open %s: %d\n", s, name, fd);
+      exit(1);
+    }
+    if(fd >= 0)
+      close(fd);
+    if(i % 2 == 1 && unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  if(unlink("hd") != 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
 // concurrent writes to try to provoke deadlock in the virtio disk
 // driver.
 void
@@ -2849,11 +3884,15 @@ diskfull(char *s)
 
   // now that there are no free blocks, test that dirlink()
   // merely fails (doesn't panic) if it can't extend
-  // directory content. one of these file creations
-  // is expected to fail.
-  int nzz = 128;
+  // directory content. new files start out inline, so they
+  // need no blocks of their own; create them until one fails,
+  // which happens once the directory's free slots run out.
+  // a block written to each soaks up any blocks still free.
+  int nzz = 32*32;
+  int zzfail = 0;
   for(int i = 0; i < nzz; i++){
     char name[32];
+    char buf[BSIZE];
     name[0] = 'z';
     name[1] = 'z';
     name[2] = '0' + (i / 32);
@@ -2861,14 +3900,24 @@ diskfull(char *s)
     name[4] = '\0';
     unlink(name);
     int fd = open(name, O_CREATE|O_RDWR|O_TRUNC);
-    if(fd < 0)
+    if(fd < 0){
+      zzfail = 1;
       break;
+    }
+    memset(buf, 0, sizeof(buf));
+    write(fd, buf, sizeof(buf));
     close(fd);
   }
+  if(!zzfail){
+    printf("%s: %d file creations on a full disk all succeeded\n", s, nzz);
+    exit(1);
+  }
 
   // this mkdir() is expected to fail.
-  if(mkdir("diskfulldir") == 0)
-    printf("%s: mkdir(diskfulldir) unexpectedly succeeded!\n");
+  if(mkdir("diskfulldir") == 0){
+    printf("%s: mkdir(diskfulldir) unexpectedly succeeded!\n", s);
+    exit(1);
+  }
 
   unlink("diskfulldir");
 
@@ -2924,13 +3973,63 @@ outofinodes(char *s)
   }
 }
 
+// a file much bigger than the old direct+indirect block limit
+// of 268 blocks, to exercise extents.
+void
+hugefile(char *s)
+{
+  enum { N = 3000 };
+  int fd, i;
+  int *p = (int*)buf;
+
+  unlink("hugefile");
+  fd = open("hugefile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create hugefile\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    p[0] = i;
+    p[BSIZE/sizeof(int) - 1] = ~i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write hugefile block %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("hugefile", O_RDONLY);
+  if(fd < 0){
+    printf("%s: cannot open hugefile\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf("%s: read hugefile block %d failed\n", s, i);
+      exit(1);
+    }
+    if(p[0] != i || p[BSIZE/sizeof(int) - 1] != ~i){
+      printf("%s: hugefile block %d has wrong content\n", s, i);
+      exit(1);
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf("%s: hugefile too long\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("hugefile");
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
+  {hashdir, "hashdir"},
   {manywrites, "manywrites"},
   {badwrite, "badwrite" },
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {hugefile, "hugefile"},
     
   { 0, 0},
 };
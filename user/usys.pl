@@ -36,3 +36,23 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("fmap");
+entry("istats");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("getdents");
+entry("fstatat");
+entry("sendfile");
+entry("splice");
+entry("fsync");
+entry("fdatasync");
+entry("logasync");
+entry("fallocate");
+entry("setpriority");
+entry("setsched");
+entry("getsched");
+entry("cpustats");
+entry("nanosleep");
+entry("nanouptime");